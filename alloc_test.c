@@ -0,0 +1,158 @@
+// alloc_test.c
+// 힙 데몬 삭제 주기의 정상 상태 할당 0회 검사
+//
+// Build:
+//   gcc -O2 -Wall -pthread -o alloc_test alloc_test.c min_heap.c dir_purge.c path_key.c retn_config.c heap_wal.c
+// Usage:
+//   ./alloc_test [CYCLES]      (기본 48: 트리를 다 지울 만큼, 실패하면 exit 1)
+//
+// 임시 디렉터리에 만기된 트리(분 단위 device + 시 단위로 펼쳐지는 device +
+// busy 디렉터리 1개)를 만들고, 데몬과 같은 초기화/스캔 뒤 --state WAL까지 켠
+// 상태로 process_due_deletes()를 CYCLES번 돌린다. 주기마다 힙에 일정량만
+// 되돌려 넣어(주기 밖에서) 매 주기가 실제로 지우게 한다. 첫 주기(stdio 버퍼 등
+// 지연 할당) 이후 한 주기라도 malloc 계열을 부르면 실패한다.
+// 카운터는 데몬의 -D_DEBUG_ 래퍼를 그대로 쓴다.
+
+#define _DEBUG_
+#define main retention_main
+#include "min_heap_retention_process.c"
+#undef main
+
+#define T_DEVICES   4           // d0은 시 단위(펼침), 나머지는 분 단위
+#define T_HOURS     2
+#define T_PER_CYCLE 8           // 주기마다 힙에 되돌려 넣는 엔트리 수
+
+static char g_tmp[] = "/tmp/alloc_test.XXXXXX";
+
+static bool mkdirs(const char *path) {
+    char buf[PATH_MAX];
+    snprintf(buf, sizeof(buf), "%s", path);
+    for (char *p = buf + 1; *p; p++) {
+        if (*p != '/') continue;
+        *p = '\0';
+        if (mkdir(buf, 0755) != 0 && errno != EEXIST) return false;
+        *p = '/';
+    }
+    return mkdir(buf, 0755) == 0 || errno == EEXIST;
+}
+
+static bool make_unit(const char *dir) {
+    char f[PATH_MAX];
+    if (!mkdirs(dir)) return false;
+    snprintf(f, sizeof(f), "%s/a.dat", dir);
+    int fd = open(f, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) return false;
+    bool ok = write(fd, "x", 1) == 1;
+    close(fd);
+    return ok;
+}
+
+// busy_grace에 걸리지 않게 모든 항목을 2020년으로 돌린다
+static int cb_age(const char *fpath, const struct stat *sb, int typeflag, struct FTW *ftwbuf) {
+    (void)sb; (void)typeflag; (void)ftwbuf;
+    struct timespec ts[2] = { { 1577836800, 0 }, { 1577836800, 0 } };
+    utimensat(AT_FDCWD, fpath, ts, AT_SYMLINK_NOFOLLOW);
+    return 0;
+}
+
+static int cb_rm(const char *fpath, const struct stat *sb, int typeflag, struct FTW *ftwbuf) {
+    (void)sb; (void)ftwbuf;
+    return typeflag == FTW_DP ? rmdir(fpath) : unlink(fpath);
+}
+
+// <tmp>/data/c1/dN/2020/01/01/HH/mm, 그리고 busy인 d1/2020/01/02/00/00
+static bool build_tree(char *config, size_t len) {
+    char path[PATH_MAX];
+    for (int d = 0; d < T_DEVICES; d++)
+        for (int h = 0; h < T_HOURS; h++)
+            for (int m = 0; m < 60; m++) {
+                snprintf(path, sizeof(path), "%s/data/c1/d%d/2020/01/01/%02d/%02d", g_tmp, d, h, m);
+                if (!make_unit(path)) return false;
+            }
+    snprintf(path, sizeof(path), "%s/data", g_tmp);
+    if (nftw(path, cb_age, 32, FTW_PHYS) != 0) return false;
+    snprintf(path, sizeof(path), "%s/data/c1/d1/2020/01/02/00/00", g_tmp);
+    if (!make_unit(path)) return false;
+
+    snprintf(config, len, "%s/config.json", g_tmp);
+    FILE *f = fopen(config, "w");
+    if (!f) return false;
+    fprintf(f, "{ \"granularity\": \"minute\",\n"
+               "  \"retention\": { \"default\": 1,\n"
+               "    \"c1\": { \"devices\": { \"d0\": { \"granularity\": \"hour\" } } } } }\n");
+    return fclose(f) == 0;
+}
+
+// main()의 초기화와 스캔을 같은 순서로 (옵션: --state <tmp>/state)
+static bool setup(const char *config) {
+    char path[PATH_MAX];
+    if (!retn_load_config(config, &g_cfg)) return false;
+    snprintf(path, sizeof(path), "%s/data", g_tmp);
+    g_roots[g_nroots++] = ps_root(path);
+
+    heap_init(&g_heap);
+    pk_init(&g_keys);
+    if (pk_add_root(&g_keys, g_roots[0].path) != 0) return false;
+    g_retry.a = (RetryEntry*)malloc((RETRY_QUEUE_MAX + 1) * sizeof(RetryEntry));
+    if (!g_retry.a || !purge_reserve_scratch()) return false;
+    g_purge_opt = g_purge_opt_default;
+    g_io_last = time(NULL);
+
+    for (g_cur_root = 0; g_cur_root < g_nroots; g_cur_root++)
+        if (nftw(g_roots[g_cur_root].path, cb_register_unit_dir, 32, FTW_PHYS | FTW_ACTIONRETVAL) != 0)
+            return false;
+
+    snprintf(path, sizeof(path), "%s/state", g_tmp);
+    wal_init(&g_wal, path, config_ident(config));
+    wal_reset(&g_wal);
+    return wal_start(&g_wal) && write_base_snapshot();
+}
+
+int main(int argc, char **argv) {
+    int cycles = argc > 1 ? atoi(argv[1]) : 48;
+    char config[PATH_MAX];
+    if (!mkdtemp(g_tmp) || !build_tree(config, sizeof(config)) || !setup(config)) {
+        perror("alloc_test: setup");
+        return 1;
+    }
+
+    // 스캔 결과를 꺼내 두었다가 주기마다 조금씩 되돌린다 (힙 용량은 그대로 남음)
+    size_t n = heap_size(&g_heap), next = 0;
+    HeapEntry *all = (HeapEntry*)malloc(n * sizeof(HeapEntry));
+    if (!all) { perror("malloc"); return 1; }
+    for (size_t i = 0; i < n; i++) heap_pop(&g_heap, &all[i]);
+
+    // 삭제 로그는 버린다 (stdout 버퍼는 첫 주기에 잡힌다)
+    fflush(stdout);
+    int devnull = open("/dev/null", O_WRONLY);
+    if (devnull >= 0) { dup2(devnull, STDOUT_FILENO); close(devnull); }
+
+    int failed = 0, worked = 0;
+    for (int c = 0; c < cycles; c++) {
+        for (int k = 0; k < T_PER_CYCLE && next < n; k++) heap_push(&g_heap, all[next++]);
+        size_t before_heap = heap_size(&g_heap);
+        unsigned long before = __atomic_load_n(&g_alloc_calls, __ATOMIC_RELAXED);
+        process_due_deletes();
+        unsigned long made = __atomic_load_n(&g_alloc_calls, __ATOMIC_RELAXED) - before;
+        worked += (heap_size(&g_heap) < before_heap);
+        if (c > 0 && made != 0) {
+            fprintf(stderr, "FAIL: cycle %d made %lu allocations\n", c + 1, made);
+            failed = 1;
+        }
+    }
+    if (worked < 2) {
+        fprintf(stderr, "FAIL: only %d cycles deleted anything\n", worked);
+        failed = 1;
+    }
+    fprintf(stderr, "%s: %d cycles, %d with deletions, %zu of %zu entries, %zu busy retries, %lu WAL records\n",
+            failed ? "FAIL" : "OK", cycles, worked, next, n, g_retry.n, g_wal.records);
+
+    wal_stop(&g_wal);
+    free(all);
+    free(g_retry.a);
+    heap_free(&g_heap);
+    pk_free(&g_keys);
+    retn_config_free(&g_cfg);
+    nftw(g_tmp, cb_rm, 32, FTW_DEPTH | FTW_PHYS);
+    return failed;
+}
@@ -0,0 +1,216 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "checkpoint.h"
+
+#define CKPT_MAGIC "rm_retention checkpoint 1\n"
+
+void ckpt_init(CKPT *ck)
+{
+  memset(ck, 0, sizeof(*ck));
+}
+
+
+void ckpt_free(CKPT *ck)
+{
+  for (uint32_t i = 0; i < ck->nroot; i++) {
+    free(ck->root[i].path);
+    free(ck->root[i].cursor);
+  }
+  free(ck->root);
+  memset(ck, 0, sizeof(*ck));
+}
+
+
+static bool add_root_n(CKPT *ck, const char *root, size_t rlen,
+    const char *cursor, size_t clen)
+{
+  if (ck->nroot == ck->cap) {
+    uint32_t ncap = ck->cap ? ck->cap * 2 : 16;
+    CKPT_ROOT *nr = (CKPT_ROOT *)realloc(ck->root, ncap * sizeof(CKPT_ROOT));
+    if (nr == NULL)
+      return false;
+    ck->root = nr;
+    ck->cap = ncap;
+  }
+
+  char *p = strndup(root, rlen);
+  char *c = cursor ? strndup(cursor, clen) : NULL;
+  if (p == NULL || (cursor && c == NULL)) {
+    free(p);
+    free(c);
+    return false;
+  }
+  ck->root[ck->nroot++] = (CKPT_ROOT){ p, c };
+  return true;
+}
+
+
+bool ckpt_add_root(CKPT *ck, const char *root, const char *cursor)
+{
+  return add_root_n(ck, root, strlen(root), cursor, cursor ? strlen(cursor) : 0);
+}
+
+
+const CKPT_ROOT *ckpt_find(const CKPT *ck, const char *root)
+{
+  for (uint32_t i = 0; i < ck->nroot; i++)
+    if (strcmp(ck->root[i].path, root) == 0)
+      return &ck->root[i];
+  return NULL;
+}
+
+
+// ---- file format ----
+// Paths are written as "<length> <bytes>", so any byte a directory name may
+// hold (blanks, newlines) survives:
+//
+//   rm_retention checkpoint 1
+//   started <epoch>
+//   counters <dirs> <files> <bytes> <malformed>
+//   done <len> <root>
+//   at <len> <root> <len> <cursor>
+//   end
+
+static bool put_path(FILE *f, const char *s)
+{
+  return fprintf(f, " %zu ", strlen(s)) > 0 && fputs(s, f) >= 0;
+}
+
+
+bool ckpt_save(const char *path, const CKPT *ck)
+{
+  char tmp[PATH_MAX];
+  if (snprintf(tmp, sizeof(tmp), "%s.tmp", path) >= (int)sizeof(tmp))
+    return false;
+
+  int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  FILE *f = (fd >= 0) ? fdopen(fd, "w") : NULL;
+  if (f == NULL) {
+    fprintf(stderr, "Error: Unable to create %s: %s\n", tmp, strerror(errno));
+    if (fd >= 0)
+      close(fd);
+    return false;
+  }
+
+  bool ok = fputs(CKPT_MAGIC, f) >= 0 &&
+    fprintf(f, "started %lld\ncounters %lu %lu %llu %lu\n", (long long)ck->started,
+        ck->dirs, ck->files, ck->bytes, ck->malformed) > 0;
+  for (uint32_t i = 0; ok && i < ck->nroot; i++) {
+    const CKPT_ROOT *r = &ck->root[i];
+    ok = fputs(r->cursor ? "at" : "done", f) >= 0 && put_path(f, r->path) &&
+      (!r->cursor || put_path(f, r->cursor)) && fputc('\n', f) != EOF;
+  }
+  ok = ok && fputs("end\n", f) >= 0 && fflush(f) == 0 && fsync(fd) == 0;
+  ok = (fclose(f) == 0) && ok;
+
+  // the rename is the commit point: readers see the old file or the new one
+  if (!ok || rename(tmp, path) != 0) {
+    fprintf(stderr, "Error: Unable to write %s: %s\n", path, strerror(errno));
+    unlink(tmp);
+    return false;
+  }
+  return true;
+}
+
+
+typedef struct tagCKPT_SCAN {
+  const char *p, *end;
+} CKPT_SCAN;
+
+static bool scan_word(CKPT_SCAN *s, const char *w)
+{
+  size_t n = strlen(w);
+  if ((size_t)(s->end - s->p) < n || memcmp(s->p, w, n) != 0)
+    return false;
+  s->p += n;
+  return true;
+}
+
+static bool scan_num(CKPT_SCAN *s, unsigned long long *out)
+{
+  if (s->p < s->end && *s->p == ' ')
+    s->p++;
+  if (s->p >= s->end || *s->p < '0' || *s->p > '9')
+    return false;
+  unsigned long long v = 0;
+  while (s->p < s->end && *s->p >= '0' && *s->p <= '9')
+    v = v * 10 + (unsigned long long)(*s->p++ - '0');
+  *out = v;
+  return true;
+}
+
+static bool scan_path(CKPT_SCAN *s, const char **str, size_t *len)
+{
+  unsigned long long n;
+  if (!scan_num(s, &n) || !scan_word(s, " ") || n == 0 ||
+      n > (unsigned long long)(s->end - s->p))
+    return false;
+  *str = s->p;
+  *len = (size_t)n;
+  s->p += n;
+  return true;
+}
+
+
+bool ckpt_load(const char *path, CKPT *ck)
+{
+  ckpt_init(ck);
+
+  FILE *f = fopen(path, "r");
+  if (f == NULL)
+    return false;
+
+  char *buf = NULL;
+  size_t len = 0, cap = 0;
+  for (;;) {
+    if (len == cap) {
+      cap = cap ? cap * 2 : 4096;
+      char *nb = (char *)realloc(buf, cap);
+      if (nb == NULL)
+        break;
+      buf = nb;
+    }
+    size_t n = fread(buf + len, 1, cap - len, f);
+    if (n == 0)
+      break;
+    len += n;
+  }
+  fclose(f);
+
+  CKPT_SCAN s = { buf, buf + len };
+  unsigned long long started, dirs, files, bytes, malformed;
+  bool ok = buf && scan_word(&s, CKPT_MAGIC) &&
+    scan_word(&s, "started") && scan_num(&s, &started) && scan_word(&s, "\n") &&
+    scan_word(&s, "counters") && scan_num(&s, &dirs) && scan_num(&s, &files) &&
+    scan_num(&s, &bytes) && scan_num(&s, &malformed) && scan_word(&s, "\n");
+
+  while (ok && !scan_word(&s, "end\n")) {
+    const char *root, *cursor = NULL;
+    size_t rlen, clen = 0;
+    if (scan_word(&s, "done"))
+      ok = scan_path(&s, &root, &rlen);
+    else
+      ok = scan_word(&s, "at") && scan_path(&s, &root, &rlen) && scan_path(&s, &cursor, &clen);
+    ok = ok && scan_word(&s, "\n") && add_root_n(ck, root, rlen, cursor, clen);
+  }
+  ok = ok && s.p == s.end;
+  free(buf);
+
+  if (!ok) {
+    fprintf(stderr, " Warning: %s is not a complete checkpoint, ignored\n", path);
+    ckpt_free(ck);
+    return false;
+  }
+  ck->started = (time_t)started;
+  ck->dirs = (unsigned long)dirs;
+  ck->files = (unsigned long)files;
+  ck->bytes = bytes;
+  ck->malformed = (unsigned long)malformed;
+  return true;
+}
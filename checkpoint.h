@@ -0,0 +1,42 @@
+#ifndef __CHECKPOINT_H__
+#define __CHECKPOINT_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+// Checkpoint of a long deletion pass (--checkpoint FILE, --resume).
+// Per root: either finished, or a cursor, the first device directory
+// (<root>/<company>/<device>, in sorted order) that was not finished yet.
+// Roots not listed were not started. Counters carry over to the resumed run.
+// Saved as a small text file, written to FILE.tmp and renamed over FILE, so
+// a crash at any point leaves the previous checkpoint intact.
+
+#define CKPT_INTERVAL 10    // seconds between saves
+
+typedef struct tagCKPT_ROOT {
+  char *path;             // trimmed root path
+  char *cursor;           // NULL: whole root done
+} CKPT_ROOT;
+
+typedef struct tagCKPT {
+  time_t started;         // start of the first run of this pass
+  unsigned long dirs, files, malformed;
+  unsigned long long bytes;
+  CKPT_ROOT *root;
+  uint32_t nroot, cap;
+} CKPT;
+
+void ckpt_init(CKPT *ck);
+void ckpt_free(CKPT *ck);
+
+// cursor NULL: the root is done
+bool ckpt_add_root(CKPT *ck, const char *root, const char *cursor);
+const CKPT_ROOT *ckpt_find(const CKPT *ck, const char *root);
+
+// false if the file is missing (quietly) or not a complete checkpoint (with a message)
+bool ckpt_load(const char *path, CKPT *ck);
+bool ckpt_save(const char *path, const CKPT *ck);
+
+#endif //__CHECKPOINT_H__
@@ -0,0 +1,94 @@
+#ifndef __DATE_PARSE_H__
+#define __DATE_PARSE_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+// Fixed-width date directory names: YYYY / MM / DD / HH / mm.
+// Each component is validated and converted in one pass; anything that is
+// not exactly the right number of ASCII digits, or out of range, is rejected
+// (atoi() would read "2025x" as 2025 and "abc" as year 0).
+
+#define DP_YEAR_MIN 1970   // nothing is stored before the epoch
+
+enum { DP_YEAR = 0, DP_MONTH, DP_DAY, DP_HOUR, DP_MINUTE, DP_NCOMP };
+
+// 4 digits at once (SWAR): check every byte is '0'..'9', then combine
+// digit pairs and pairs of pairs with two multiplies
+static inline bool dp_digits4(const char *s, int *out)
+{
+  uint32_t v;
+  memcpy(&v, s, 4);
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+  v = __builtin_bswap32(v);   // first character in the low byte
+#endif
+  if ((v & 0xF0F0F0F0u) != 0x30303030u ||
+      ((v + 0x06060606u) & 0xF0F0F0F0u) != 0x30303030u)
+    return false;
+
+  v -= 0x30303030u;
+  v = (v * 10 + (v >> 8)) & 0x00FF00FFu;   // bytes 0 and 2: "12" "34"
+  *out = (int)((v & 0xFF) * 100 + (v >> 16));
+  return true;
+}
+
+static inline bool dp_digits2(const char *s, int *out)
+{
+  unsigned a = (unsigned char)s[0] - '0', b = (unsigned char)s[1] - '0';
+  if (a > 9 || b > 9)
+    return false;
+  *out = (int)(a * 10 + b);
+  return true;
+}
+
+static inline int dp_days_in_month(int y, int m)
+{
+  static const unsigned char mdays[12] = { 31,28,31,30,31,30,31,31,30,31,30,31 };
+  if (m == 2 && (y % 4 == 0 && (y % 100 != 0 || y % 400 == 0)))
+    return 29;
+  return mdays[m - 1];
+}
+
+// One component on its own (day only checked against 1..31); for walkers
+// that validate each directory name as they descend.
+static inline bool dp_component(int i, const char *s, size_t len, int *out)
+{
+  int v;
+  if (i == DP_YEAR)
+    return len == 4 && dp_digits4(s, out) && *out >= DP_YEAR_MIN;
+  if (len != 2 || !dp_digits2(s, &v))
+    return false;
+
+  switch (i) {
+    case DP_MONTH:  if (v < 1 || v > 12) return false; break;
+    case DP_DAY:    if (v < 1 || v > 31) return false; break;
+    case DP_HOUR:   if (v > 23) return false; break;
+    case DP_MINUTE: if (v > 59) return false; break;
+    default:        return false;
+  }
+  *out = v;
+  return true;
+}
+
+// Parse the first n (1..5) date components, given as (ptr, len) spans.
+// out[] = year, month, day, hour, minute; components past n get the start of
+// the period (month 1, day 1, 00:00). Returns the index of the first bad
+// component, or -1 when all n are valid.
+static inline int dp_parse_date(const char *const comp[], const size_t len[], int n, int out[DP_NCOMP])
+{
+  out[DP_YEAR] = DP_YEAR_MIN;
+  out[DP_MONTH] = out[DP_DAY] = 1;
+  out[DP_HOUR] = out[DP_MINUTE] = 0;
+
+  for (int i = 0; i < n && i < DP_NCOMP; i++) {
+    if (!dp_component(i, comp[i], len[i], &out[i]))
+      return i;
+    if (i == DP_DAY && out[i] > dp_days_in_month(out[DP_YEAR], out[DP_MONTH]))
+      return i;
+  }
+  return -1;
+}
+
+#endif //__DATE_PARSE_H__
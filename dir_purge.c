@@ -0,0 +1,377 @@
+#define _GNU_SOURCE
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "dir_purge.h"
+
+// ---- getdents64 reader ----
+
+struct linux_dirent64 {
+  uint64_t d_ino;
+  int64_t d_off;
+  unsigned short d_reclen;
+  unsigned char d_type;
+  char d_name[];
+};
+
+static __thread char *tl_dents[PURGE_DENTS_DEPTH];
+static __thread int tl_depth;
+
+bool purge_reserve_scratch(void)
+{
+  for (int i = 0; i < PURGE_DENTS_DEPTH; i++)
+    if (tl_dents[i] == NULL && (tl_dents[i] = (char *)malloc(PURGE_DENTS_BUF)) == NULL)
+      return false;
+  return true;
+}
+
+
+bool purge_dents_open(PURGE_DENTS *d, int fd)
+{
+  memset(d, 0, sizeof(*d));
+  d->fd = fd;
+  int depth = tl_depth;
+  if (depth < PURGE_DENTS_DEPTH) {
+    if (tl_dents[depth] == NULL)
+      tl_dents[depth] = (char *)malloc(PURGE_DENTS_BUF);
+    d->buf = tl_dents[depth];
+  }
+  else {
+    d->buf = (char *)malloc(PURGE_DENTS_BUF);
+    d->borrowed = true;
+  }
+  if (d->buf == NULL) {
+    close(fd);
+    errno = ENOMEM;
+    return false;
+  }
+  tl_depth++;
+  return true;
+}
+
+
+bool purge_dents_next(PURGE_DENTS *d, const char **name, unsigned char *d_type)
+{
+  for (;;) {
+    if (d->pos >= d->len) {
+      long n = syscall(SYS_getdents64, d->fd, d->buf, PURGE_DENTS_BUF);
+      if (n <= 0) {
+        d->err = (n < 0) ? errno : 0;
+        return false;
+      }
+      d->pos = 0;
+      d->len = (size_t)n;
+    }
+    const struct linux_dirent64 *de = (const struct linux_dirent64 *)(d->buf + d->pos);
+    d->pos += de->d_reclen;
+
+    const char *n = de->d_name;
+    if (n[0] == '.' && (n[1] == '\0' || (n[1] == '.' && n[2] == '\0')))
+      continue;
+    *name = n;
+    *d_type = de->d_type;
+    return true;
+  }
+}
+
+
+void purge_dents_close(PURGE_DENTS *d)
+{
+  close(d->fd);
+  if (d->borrowed)
+    free(d->buf);
+  tl_depth--;
+  d->fd = -1;
+  d->buf = NULL;
+}
+
+// one entry of an open directory; files are unlinked, directories recursed
+static PURGE_RESULT purge_entry(int dfd, const char *n, unsigned char type,
+    const PURGE_OPT *opt, PURGE_STAT *st, unsigned long *unpaced)
+{
+  unsigned long long blocks = 0;
+  if (type == DT_UNKNOWN || (opt->count_bytes && type != DT_DIR)) {
+    // only filesystems without d_type support, or accounting, pay for this
+    // stat; a directory's own size is taken from its fd in purge_dir_at()
+    struct stat sb;
+    if (fstatat(dfd, n, &sb, AT_SYMLINK_NOFOLLOW) != 0) {
+      if (errno == ENOENT)
+        return PURGE_DONE;
+      perror(n);
+      st->errors++;
+      return PURGE_ERROR;
+    }
+    type = S_ISDIR(sb.st_mode) ? DT_DIR : DT_REG;
+    blocks = (unsigned long long)sb.st_blocks;
+  }
+
+  if (type == DT_DIR) {
+    PURGE_RESULT r = purge_dir_at(dfd, n, opt, st);
+    return (r == PURGE_GONE) ? PURGE_DONE : r;
+  }
+
+  if (opt->dry_run) {
+    st->files++;
+    st->bytes += blocks * 512;
+    return PURGE_DONE;
+  }
+
+  struct timespec t0, t1;
+  if (opt->latency)
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+
+  if (unlinkat(dfd, n, 0) == 0) {
+    if (opt->latency) {
+      clock_gettime(CLOCK_MONOTONIC, &t1);
+      opt->latency(opt->latency_arg, (unsigned long)((t1.tv_sec - t0.tv_sec) * 1000000000L +
+            (t1.tv_nsec - t0.tv_nsec)));
+    }
+    st->files++;
+    st->bytes += blocks * 512;
+    if (opt->pace && ++*unpaced == PURGE_PACE_BATCH) {
+      opt->pace(opt->pace_arg, *unpaced);
+      *unpaced = 0;
+    }
+    return PURGE_DONE;
+  }
+  if (errno == EBUSY || errno == ETXTBSY)
+    return PURGE_BUSY;
+  if (errno == ENOENT)
+    return PURGE_DONE;
+
+  perror(n);
+  st->errors++;
+  return PURGE_ERROR;
+}
+
+
+static void merge_result(PURGE_RESULT *res, PURGE_RESULT r)
+{
+  if (r == PURGE_BUSY && *res == PURGE_DONE)
+    *res = PURGE_BUSY;
+  else if (r == PURGE_ERROR)
+    *res = PURGE_ERROR;
+}
+
+
+// ---- parallel unlink of one large directory ----
+
+// file names of one directory, packed in one buffer
+typedef struct tagNAME_LIST {
+  char *buf;
+  size_t len, cap;
+  size_t *off;
+  size_t n, ncap;
+} NAME_LIST;
+
+static bool name_add(NAME_LIST *nl, const char *name)
+{
+  size_t n = strlen(name) + 1;
+  if (nl->len + n > nl->cap) {
+    size_t ncap = (nl->len + n) * 2;
+    char *nb = (char *)realloc(nl->buf, ncap);
+    if (nb == NULL)
+      return false;
+    nl->buf = nb;
+    nl->cap = ncap;
+  }
+  if (nl->n == nl->ncap) {
+    size_t ncap = nl->ncap ? nl->ncap * 2 : PURGE_PAR_MIN;
+    size_t *no = (size_t *)realloc(nl->off, ncap * sizeof(size_t));
+    if (no == NULL)
+      return false;
+    nl->off = no;
+    nl->ncap = ncap;
+  }
+  memcpy(nl->buf + nl->len, name, n);
+  nl->off[nl->n++] = nl->len;
+  nl->len += n;
+  return true;
+}
+
+typedef struct tagPAR_UNLINK {
+  int fd;
+  const NAME_LIST *names;
+  const PURGE_OPT *opt;
+  size_t next;            // next chunk (atomic)
+  PURGE_RESULT res;       // merged under lock
+  PURGE_STAT st;
+  pthread_mutex_t lock;
+} PAR_UNLINK;
+
+static void *par_unlink_main(void *p)
+{
+  PAR_UNLINK *pu = (PAR_UNLINK *)p;
+  const NAME_LIST *nl = pu->names;
+  PURGE_STAT st = {0};
+  PURGE_RESULT res = PURGE_DONE;
+  unsigned long unpaced = 0;
+  size_t i;
+
+  while ((i = __atomic_fetch_add(&pu->next, PURGE_PAR_CHUNK, __ATOMIC_RELAXED)) < nl->n) {
+    size_t end = (i + PURGE_PAR_CHUNK < nl->n) ? i + PURGE_PAR_CHUNK : nl->n;
+    for (; i < end; i++)
+      merge_result(&res, purge_entry(pu->fd, nl->buf + nl->off[i], DT_REG, pu->opt, &st, &unpaced));
+  }
+  if (pu->opt->pace && unpaced)
+    pu->opt->pace(pu->opt->pace_arg, unpaced);
+
+  pthread_mutex_lock(&pu->lock);
+  merge_result(&pu->res, res);
+  pu->st.files += st.files;
+  pu->st.errors += st.errors;
+  pu->st.bytes += st.bytes;
+  pthread_mutex_unlock(&pu->lock);
+  return NULL;
+}
+
+// the caller is one of the threads; if none can be started, it does it all
+static PURGE_RESULT par_unlink(int fd, const NAME_LIST *nl, const PURGE_OPT *opt,
+    PURGE_STAT *st)
+{
+  PAR_UNLINK pu = { .fd = fd, .names = nl, .opt = opt, .res = PURGE_DONE };
+  pthread_mutex_init(&pu.lock, NULL);
+
+  pthread_t thr[PURGE_PAR_MAX];
+  int extra = ((opt->threads < PURGE_PAR_MAX) ? opt->threads : PURGE_PAR_MAX) - 1, started = 0;
+  if ((size_t)extra > nl->n / PURGE_PAR_CHUNK)
+    extra = (int)(nl->n / PURGE_PAR_CHUNK);
+  for (int k = 0; k < extra; k++)
+    if (pthread_create(&thr[started], NULL, par_unlink_main, &pu) == 0)
+      started++;
+  par_unlink_main(&pu);
+  for (int k = 0; k < started; k++)
+    pthread_join(thr[k], NULL);
+
+  pthread_mutex_destroy(&pu.lock);
+  st->files += pu.st.files;
+  st->errors += pu.st.errors;
+  st->bytes += pu.st.bytes;
+  return pu.res;
+}
+
+
+static PURGE_RESULT purge_children(int fd, const char *name,
+    const PURGE_OPT *opt, PURGE_STAT *st)
+{
+  PURGE_DENTS dir;
+  if (!purge_dents_open(&dir, fd)) {
+    perror(name);
+    st->errors++;
+    return PURGE_ERROR;
+  }
+
+  PURGE_RESULT res = PURGE_DONE;
+  const char *n;
+  unsigned char type;
+  unsigned long unpaced = 0;
+
+  // with threads, files are listed first (subdirectories go as they come);
+  // short lists are then unlinked here, long ones in parallel
+  bool par = (opt->threads > 1 && !opt->dry_run);
+  NAME_LIST nl = {0};
+
+  while (purge_dents_next(&dir, &n, &type)) {
+    if (par && type != DT_DIR && type != DT_UNKNOWN && name_add(&nl, n))
+      continue;
+    merge_result(&res, purge_entry(dir.fd, n, type, opt, st, &unpaced));
+  }
+  // an unread rest would otherwise surface as ENOTEMPTY, i.e. busy
+  if (dir.err) {
+    errno = dir.err;
+    perror(name);
+    st->errors++;
+    res = PURGE_ERROR;
+  }
+
+  if (nl.n >= PURGE_PAR_MIN) {
+    merge_result(&res, par_unlink(dir.fd, &nl, opt, st));
+  }
+  else {
+    for (size_t i = 0; i < nl.n; i++)
+      merge_result(&res, purge_entry(dir.fd, nl.buf + nl.off[i], DT_REG, opt, st, &unpaced));
+  }
+  free(nl.buf);
+  free(nl.off);
+
+  if (opt->pace && unpaced)
+    opt->pace(opt->pace_arg, unpaced);
+  purge_dents_close(&dir);
+  return res;
+}
+
+
+PURGE_RESULT purge_entry_at(int dir_fd, const char *name, unsigned char d_type,
+    const PURGE_OPT *opt, PURGE_STAT *st)
+{
+  unsigned long unpaced = 0;
+  PURGE_RESULT r = purge_entry(dir_fd, name, d_type, opt, st, &unpaced);
+  if (opt->pace && unpaced)
+    opt->pace(opt->pace_arg, unpaced);
+  return r;
+}
+
+
+PURGE_RESULT purge_dir_at(int parent_fd, const char *name,
+    const PURGE_OPT *opt, PURGE_STAT *st)
+{
+  int fd = openat(parent_fd, name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+  if (fd < 0) {
+    if (errno == ENOENT)
+      return PURGE_GONE;
+    perror(name);
+    st->errors++;
+    return PURGE_ERROR;
+  }
+
+  // a recently modified directory means files are still being created in it
+  unsigned long long blocks = 0;
+  if (opt->busy_grace > 0 || opt->count_bytes) {
+    struct stat sb;
+    if (fstat(fd, &sb) == 0) {
+      if (opt->busy_grace > 0 && sb.st_mtime > time(NULL) - opt->busy_grace) {
+        close(fd);
+        st->busy++;
+        return PURGE_BUSY;
+      }
+      blocks = (unsigned long long)sb.st_blocks;
+    }
+  }
+
+  PURGE_RESULT res = purge_children(fd, name, opt, st);
+  if (res != PURGE_DONE)
+    return res;
+
+  if (opt->dry_run) {
+    st->dirs++;
+    st->bytes += blocks * 512;
+    return PURGE_DONE;
+  }
+
+  if (unlinkat(parent_fd, name, AT_REMOVEDIR) == 0) {
+    st->dirs++;
+    st->bytes += blocks * 512;
+    return PURGE_DONE;
+  }
+
+  // a writer added files after we emptied it, or it is a mount point
+  if (errno == ENOTEMPTY || errno == EEXIST || errno == EBUSY) {
+    st->busy++;
+    return PURGE_BUSY;
+  }
+  if (errno == ENOENT)
+    return PURGE_DONE;
+
+  perror(name);
+  st->errors++;
+  return PURGE_ERROR;
+}
@@ -0,0 +1,92 @@
+#ifndef __DIR_PURGE_H__
+#define __DIR_PURGE_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <time.h>
+
+// Directory-fd-relative subtree removal.
+// Children are removed with unlinkat() on the parent's fd, using d_type so
+// that regular files never need a stat. Only each directory itself is
+// fstat'ed once, to detect a writer that is still filling it. With
+// count_bytes, every entry is stat'ed once for its allocated size.
+
+typedef enum {
+  PURGE_DONE = 0,   // directory and everything below it removed
+  PURGE_GONE,       // directory did not exist (already removed)
+  PURGE_BUSY,       // still being written; retry later
+  PURGE_ERROR       // unexpected error, reported with perror()
+} PURGE_RESULT;
+
+#define PURGE_PACE_BATCH 64
+
+// A directory with at least PURGE_PAR_MIN files is emptied by opt.threads
+// threads unlinking on its one fd, each taking PURGE_PAR_CHUNK names at a
+// time. Unlinks in one directory serialize on its inode lock for part of
+// the work only, so this scales some way on ext4 and XFS.
+#define PURGE_PAR_MIN   2048
+#define PURGE_PAR_CHUNK 256
+#define PURGE_PAR_MAX   32      // threads per directory, at most
+
+typedef struct tagPURGE_OPT {
+  time_t busy_grace;   // dir mtime newer than now - busy_grace => busy (0: off)
+  bool dry_run;        // only count what would be removed; callers report it
+  bool count_bytes;    // add st_blocks * 512 of everything removed to bytes
+  int threads;         // unlink threads for large directories (0, 1: serial)
+
+  // optional I/O pacing: called with the number of files unlinked since the
+  // last call, every PURGE_PACE_BATCH unlinks and when a directory is done;
+  // it may sleep to keep the caller within an unlink budget. With threads > 1
+  // it and latency are called from several threads at once.
+  void (*pace)(void *arg, unsigned long files);
+  void *pace_arg;
+
+  // optional latency sampling: every successful file unlink is timed and
+  // reported in nanoseconds
+  void (*latency)(void *arg, unsigned long ns);
+  void *latency_arg;
+} PURGE_OPT;
+
+typedef struct tagPURGE_STAT {
+  unsigned long files;    // non-directory entries unlinked
+  unsigned long dirs;     // directories removed
+  unsigned long busy;     // directories left in place as busy
+  unsigned long errors;
+  unsigned long long bytes;   // with count_bytes only
+} PURGE_STAT;
+
+// ---- directory reading without DIR ----
+// fdopendir() mallocs a DIR with its buffer for every directory. Entries are
+// read with getdents64 into per-thread buffers instead, one per nesting
+// depth, kept for the thread's later directories: once warm, reading a
+// directory allocates nothing. Opens and closes on a thread must nest.
+#define PURGE_DENTS_BUF    32768
+#define PURGE_DENTS_DEPTH  16     // deeper levels borrow a malloc'ed buffer
+
+typedef struct tagPURGE_DENTS {
+  int fd;
+  char *buf;
+  size_t pos, len;
+  bool borrowed;          // buf is malloc'ed for this directory only
+  int err;                // errno of a failed getdents64, 0 at a clean end
+} PURGE_DENTS;
+
+// takes fd (closed by purge_dents_close); false: fd closed, errno set
+bool purge_dents_open(PURGE_DENTS *d, int fd);
+// next entry other than "." and ".."; false at the end or on error (d->err)
+bool purge_dents_next(PURGE_DENTS *d, const char **name, unsigned char *d_type);
+void purge_dents_close(PURGE_DENTS *d);
+
+// allocate this thread's buffers for every depth now
+bool purge_reserve_scratch(void);
+
+// Remove directory `name` (relative to parent_fd, or absolute) with all contents.
+PURGE_RESULT purge_dir_at(int parent_fd, const char *name,
+    const PURGE_OPT *opt, PURGE_STAT *st);
+
+// Remove one entry of an open directory: a file, or a directory with all its
+// contents. d_type as read from readdir() (DT_UNKNOWN: stat'ed here).
+PURGE_RESULT purge_entry_at(int dir_fd, const char *name, unsigned char d_type,
+    const PURGE_OPT *opt, PURGE_STAT *st);
+
+#endif //__DIR_PURGE_H__
@@ -0,0 +1,171 @@
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "forecast.h"
+
+// per-company histograms, devices folded in
+typedef struct tagFC_COMPANY {
+  const char *name;
+  uint64_t *expire;       // [days + 1]; day 0 also holds what is overdue
+  uint64_t ingest;        // bytes written over the window
+} FC_COMPANY;
+
+typedef struct tagFC_LIST {
+  FC_COMPANY *c;
+  size_t n, cap;
+  int days;
+} FC_LIST;
+
+
+// Entries arrive sorted by company. c[0 .. nsorted) came from an earlier
+// pass and is sorted as well; past it, a match can only be the last one.
+static FC_COMPANY *company_of(FC_LIST *l, size_t nsorted, const char *name)
+{
+  size_t lo = 0, hi = nsorted;
+  while (lo < hi) {
+    size_t mid = lo + (hi - lo) / 2;
+    int r = sa_name_cmp(l->c[mid].name, name);
+    if (r == 0)
+      return &l->c[mid];
+    if (r < 0)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  if (l->n > nsorted && strcmp(l->c[l->n - 1].name, name) == 0)
+    return &l->c[l->n - 1];
+
+  if (l->n == l->cap) {
+    size_t ncap = l->cap ? l->cap * 2 : 64;
+    FC_COMPANY *nc = (FC_COMPANY *)realloc(l->c, ncap * sizeof(FC_COMPANY));
+    if (nc == NULL)
+      return NULL;
+    l->c = nc;
+    l->cap = ncap;
+  }
+  uint64_t *h = (uint64_t *)calloc((size_t)l->days + 1, sizeof(uint64_t));
+  if (h == NULL)
+    return NULL;
+  l->c[l->n] = (FC_COMPANY){ name, h, 0 };
+  return &l->c[l->n++];
+}
+
+
+static const char *day_str(int32_t day, char buf[32])
+{
+  time_t t = (time_t)day * 86400;
+  struct tm tm;
+  gmtime_r(&t, &tm);
+  snprintf(buf, 32, "%04d-%02d-%02d", tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday);
+  return buf;
+}
+
+
+static int company_cmp(const void *a, const void *b)
+{
+  return sa_name_cmp(((const FC_COMPANY *)a)->name, ((const FC_COMPANY *)b)->name);
+}
+
+
+static bool collect(FC_LIST *l, const SA_TABLE *t, const FC_PARAM *p, bool expire)
+{
+  size_t n, nsorted = l->n;
+  const SA_ENTRY **ent = sa_sorted(t, &n);
+  if (ent == NULL)
+    return false;
+
+  for (size_t i = 0; i < n; i++) {
+    FC_COMPANY *c = company_of(l, nsorted, ent[i]->company);
+    if (c == NULL) {
+      free(ent);
+      return false;
+    }
+    if (!expire) {
+      c->ingest += ent[i]->bytes;
+      continue;
+    }
+    int32_t k = ent[i]->day - p->today;
+    if (k < 0)
+      k = 0;            // overdue: goes on the next run
+    if (k <= p->days)
+      c->expire[k] += ent[i]->bytes;
+  }
+  free(ent);
+  return true;
+}
+
+
+bool fc_report(SA_SET *expire, SA_SET *ingest, const FC_PARAM *p, FILE *out, FILE *json)
+{
+  SA_TABLE te = {0}, ti = {0};
+  FC_LIST l = { NULL, 0, 0, p->days };
+  uint64_t *day_exp = (uint64_t *)calloc((size_t)p->days + 1, sizeof(uint64_t));
+  bool ok = day_exp && sa_merge(expire, &te) && sa_merge(ingest, &ti) &&
+    collect(&l, &te, p, true) && collect(&l, &ti, p, false);
+
+  if (ok) {
+    qsort(l.c, l.n, sizeof(FC_COMPANY), company_cmp);
+
+    uint64_t rate = 0;    // bytes per day, all companies
+    for (size_t i = 0; i < l.n; i++) {
+      rate += l.c[i].ingest / (uint64_t)p->window;
+      for (int k = 0; k <= p->days; k++)
+        day_exp[k] += l.c[i].expire[k];
+    }
+
+    char d[32];
+    fprintf(out, "Forecast: %d days from %s, ingest %llu bytes/day (mean of the last %d days)\n",
+        p->days, day_str(p->today, d), (unsigned long long)rate, p->window);
+    fprintf(out, "Used now: %llu of %llu bytes on %u filesystems\n",
+        (unsigned long long)p->used, (unsigned long long)p->size, p->nfs);
+    fprintf(out, "%-12s %16s %16s %18s\n", "day", "expiring", "ingest", "projected used");
+
+    if (json) {
+      fprintf(json, "{\n  \"start\": ");
+      sa_put_day(json, p->today);
+      fprintf(json, ",\n  \"days\": %d,\n  \"window\": %d,\n  \"used\": %llu,\n  \"size\": %llu,\n"
+          "  \"ingest_per_day\": %llu,\n  \"forecast\": [", p->days, p->window,
+          (unsigned long long)p->used, (unsigned long long)p->size, (unsigned long long)rate);
+    }
+
+    // end of day k: k + 1 days of ingest, expiries of days 0..k
+    int64_t used = (int64_t)p->used;
+    for (int k = 0; k <= p->days; k++) {
+      used += (int64_t)rate - (int64_t)day_exp[k];
+      int64_t shown = used < 0 ? 0 : used;
+      fprintf(out, "%-12s %16llu %16llu %18lld\n", day_str(p->today + k, d),
+          (unsigned long long)day_exp[k],
+          (unsigned long long)rate, (long long)shown);
+      if (json) {
+        fprintf(json, "%s\n    { \"day\": ", k ? "," : "");
+        sa_put_day(json, p->today + k);
+        fprintf(json, ", \"expiring\": %llu, \"projected\": %lld }",
+            (unsigned long long)day_exp[k], (long long)shown);
+      }
+    }
+
+    if (json) {
+      fprintf(json, "\n  ],\n  \"companies\": {");
+      for (size_t i = 0; i < l.n; i++) {
+        fprintf(json, "%s\n    ", i ? "," : "");
+        sa_put_string(json, l.c[i].name);
+        fprintf(json, ": { \"ingest_per_day\": %llu, \"expiring\": [",
+            (unsigned long long)(l.c[i].ingest / (uint64_t)p->window));
+        for (int k = 0; k <= p->days; k++)
+          fprintf(json, "%s%llu", k ? ", " : "", (unsigned long long)l.c[i].expire[k]);
+        fprintf(json, "] }");
+      }
+      fprintf(json, "%s}\n}\n", l.n ? "\n  " : " ");
+      ok = !ferror(json);
+    }
+  }
+
+  for (size_t i = 0; i < l.n; i++)
+    free(l.c[i].expire);
+  free(l.c);
+  free(day_exp);
+  sa_table_free(&te);
+  sa_table_free(&ti);
+  return ok;
+}
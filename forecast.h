@@ -0,0 +1,31 @@
+#ifndef __FORECAST_H__
+#define __FORECAST_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "space_acct.h"
+
+// Capacity forecast (--forecast DAYS).
+// One pass over the tree fills two per-day histograms per company (kept in
+// space_acct tables, one per worker thread):
+//   expire: bytes by the day they expire under the current config.json
+//   ingest: bytes by the day they were written, for the last `window` days
+// Usage on day k is projected as
+//   used now + k * daily ingest - everything expiring on days 0..k.
+
+#define FC_WINDOW_DAYS 7    // ingest rate = mean of the last 7 complete days
+
+typedef struct tagFC_PARAM {
+  int32_t today;          // day 0, days since 1970-01-01 (UTC)
+  int days;               // horizon: days 0 .. days
+  int window;             // ingest measured over days today-window .. today-1
+  uint64_t used, size;    // filesystems of the roots, from statvfs()
+  uint32_t nfs;
+} FC_PARAM;
+
+// print the per-day table to `out`; json (optional) gets the per-company detail
+bool fc_report(SA_SET *expire, SA_SET *ingest, const FC_PARAM *p, FILE *out, FILE *json);
+
+#endif //__FORECAST_H__
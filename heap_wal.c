@@ -0,0 +1,673 @@
+#define _GNU_SOURCE
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "heap_wal.h"
+
+#define SNAP_MAGIC "HEAPSNP2"
+
+typedef struct {
+    char     magic[8];
+    uint64_t seq;           // 이 스냅샷 다음에 재생할 첫 세그먼트
+    uint64_t ident;
+    uint64_t meta_len;
+    uint64_t nheap;         // 뒤따르는 HeapEntry 수 (순서 무관)
+} SnapHdr;
+
+static uint32_t rec_crc(const WalRec *r, const char *name) {
+    uint32_t h = 2166136261u;
+    const unsigned char *p = (const unsigned char*)r + sizeof(r->crc);
+    for (size_t i=0; i<sizeof(*r)-sizeof(r->crc); i++) { h ^= p[i]; h *= 16777619u; }
+    for (size_t i=0; i<r->len; i++) { h ^= (unsigned char)name[i]; h *= 16777619u; }
+    return h;
+}
+
+static WalRec make_rec(WalType t, uint32_t aux, int64_t expire, uint64_t key, size_t len) {
+    WalRec r;
+    memset(&r, 0, sizeof(r));       // pad까지 crc에 들어가므로
+    r.type = (uint8_t)t; r.len = (uint16_t)len; r.aux = aux;
+    r.expire = expire; r.key = key;
+    return r;
+}
+
+static void seg_path(const HeapWal *w, uint64_t seq, char *out, size_t n) {
+    snprintf(out, n, "%s/wal.%llu", w->dir, (unsigned long long)seq);
+}
+
+static double elapsed_ms(const struct timespec *a, const struct timespec *b) {
+    return (double)(b->tv_sec - a->tv_sec)*1e3 + (double)(b->tv_nsec - a->tv_nsec)/1e6;
+}
+
+// 새 파일 이름(세그먼트, rename한 스냅샷)이 디렉터리에 남도록
+static void sync_dir(const HeapWal *w) {
+    int fd = open(w->dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd >= 0) { fsync(fd); close(fd); }
+}
+
+static bool write_all(int fd, const void *p, size_t n) {
+    const char *c = (const char*)p;
+    while (n) {
+        ssize_t k = write(fd, c, n);
+        if (k < 0) { if (errno == EINTR) continue; return false; }
+        c += k; n -= (size_t)k;
+    }
+    return true;
+}
+
+void wal_init(HeapWal *w, const char *dir, uint64_t ident) {
+    memset(w, 0, sizeof(*w));
+    snprintf(w->dir, sizeof(w->dir), "%s", dir);
+    w->ident = ident;
+    w->fd = -1;
+    w->seq = w->oldest = 1;
+    pthread_mutex_init(&w->lock, NULL);
+    pthread_cond_init(&w->cond, NULL);
+}
+
+// ---- 복구 ----
+static const char *map_file(const char *path, size_t *len) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return NULL;
+    struct stat st;
+    void *p = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && st.st_size > 0) {
+        p = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (p != MAP_FAILED) madvise(p, (size_t)st.st_size, MADV_SEQUENTIAL);
+    }
+    close(fd);
+    *len = (p == MAP_FAILED) ? 0 : (size_t)st.st_size;
+    return (p == MAP_FAILED) ? "" : (const char*)p;     // 빈 파일은 ""
+}
+
+// 레코드 열 재생. 잘리거나 crc가 틀린 레코드에서 멈추고 *valid에 그 앞까지의 길이를 둔다.
+// 그것이 허용되는지(마지막 세그먼트의 꼬리 = 커밋 전에 죽음)는 호출한 쪽이 판단한다
+static bool replay(const char *p, size_t n, WalApplyFn apply, void *arg,
+                   unsigned long *count, size_t *valid) {
+    size_t off = 0;
+    while (off < n) {
+        WalRec r;
+        if (n - off < sizeof(r)) break;
+        memcpy(&r, p + off, sizeof(r));
+        const char *name = p + off + sizeof(r);
+        if (n - off - sizeof(r) < r.len || rec_crc(&r, name) != r.crc) break;
+        if (!apply(arg, &r, name)) return false;
+        off += sizeof(r) + r.len;
+        (*count)++;
+    }
+    *valid = off;
+    return true;
+}
+
+bool wal_recover(HeapWal *w, WalApplyFn apply, void *arg) {
+    struct timespec t0, t1;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/snapshot", w->dir);
+    size_t n;
+    const char *p = map_file(path, &n);
+    if (!p) {
+        printf("State: no snapshot in %s, scanning\n", w->dir);
+        return false;
+    }
+
+    SnapHdr h;
+    unsigned long nrec = 0;
+    if (n < sizeof(h)) goto bad;
+    memcpy(&h, p, sizeof(h));
+    if (memcmp(h.magic, SNAP_MAGIC, sizeof(h.magic)) != 0 ||
+        h.meta_len > n - sizeof(h) || h.nheap != (n - sizeof(h) - h.meta_len)/sizeof(HeapEntry)) {
+        fprintf(stderr, " Warning: %s is damaged, scanning\n", path);
+        goto bad;
+    }
+    if (h.ident != w->ident) {
+        printf("State: config changed since the snapshot, scanning\n");
+        goto bad;
+    }
+    size_t valid;
+    if (!replay(p + sizeof(h), h.meta_len, apply, arg, &nrec, &valid) || valid != h.meta_len)
+        goto mismatch;
+
+    // 기준 스냅샷은 힙 배열 순서라 push가 제자리에서 끝나고, 압축본도 대부분 그 순서를 유지한다
+    const char *e = p + sizeof(h) + h.meta_len;
+    for (uint64_t i=0; i<h.nheap; i++, e += sizeof(HeapEntry)) {
+        HeapEntry he;
+        memcpy(&he, e, sizeof(he));
+        WalRec r = make_rec(WAL_PUSH, 0, he.expire, he.key, 0);
+        if (!apply(arg, &r, "")) goto mismatch;
+    }
+    munmap((void*)p, n);
+    p = NULL;
+
+    // 스냅샷 rename 뒤, 이전 세그먼트를 지우기 전에 죽었으면 남아 있다
+    for (uint64_t s = h.seq - 1; s > 0; s--) {
+        seg_path(w, s, path, sizeof(path));
+        if (unlink(path) != 0) break;
+    }
+
+    unsigned long nwal = 0;
+    uint64_t s;
+    for (s = h.seq; ; s++) {
+        seg_path(w, s, path, sizeof(path));
+        const char *q = map_file(path, &n);
+        if (!q) break;
+        bool r = replay(q, n, apply, arg, &nwal, &valid);
+        if (n) munmap((void*)q, n);
+        if (!r) goto mismatch;
+        if (valid != n) {
+            // 잘린 꼬리는 마지막 세그먼트에서만: 뒤에 세그먼트가 있으면 중간 레코드를 잃은 것
+            seg_path(w, s + 1, path, sizeof(path));
+            if (access(path, F_OK) == 0) goto mismatch;
+            w->tail_seq = s;        // wal_start가 여기까지로 자른다 (--dry-run은 읽기만)
+            w->tail_len = valid;
+            s++;
+            break;
+        }
+    }
+    w->oldest = h.seq;
+    w->has_base = true;
+    w->seq = s;             // 이어 쓰지 않고 새 세그먼트에서 시작 (잘린 꼬리 뒤에 붙이지 않도록)
+
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    printf("State: %llu entries + %lu WAL records from %s in %.3f s\n",
+           (unsigned long long)h.nheap, nwal, w->dir, elapsed_ms(&t0, &t1)/1e3);
+    return true;
+
+mismatch:
+    fprintf(stderr, " Warning: saved state in %s does not replay cleanly, scanning\n", w->dir);
+bad:
+    if (p && n) munmap((void*)p, n);
+    return false;
+}
+
+void wal_reset(HeapWal *w) {
+    DIR *d = opendir(w->dir);
+    if (d) {
+        struct dirent *de;
+        while ((de = readdir(d)) != NULL) {
+            if (strncmp(de->d_name, "wal.", 4) == 0 || strcmp(de->d_name, "snapshot") == 0 ||
+                strcmp(de->d_name, "snapshot.tmp") == 0)
+                unlinkat(dirfd(d), de->d_name, 0);
+        }
+        closedir(d);
+    }
+    w->seq = w->oldest = 1;
+    w->has_base = false;
+    w->tail_seq = 0;
+}
+
+// ---- 기록 ----
+// 기록 실패(디스크 가득 등) 이후의 상태는 믿을 수 없으므로 스냅샷을 지워 다음 시작은 스캔하게 한다
+static void wal_fail(HeapWal *w, const char *what) {
+    char path[PATH_MAX];
+    int fd = w->fd;
+    fprintf(stderr, " Warning: %s: %s; state in %s dropped\n", what, strerror(errno), w->dir);
+    snprintf(path, sizeof(path), "%s/snapshot", w->dir);
+    // 압축 스레드의 fd 검사 + rename과 엇갈리지 않게: 그 전이면 rename을 안 하고, 후면 여기서 지운다
+    pthread_mutex_lock(&w->lock);
+    __atomic_store_n(&w->fd, -1, __ATOMIC_RELEASE);
+    unlink(path);
+    pthread_mutex_unlock(&w->lock);
+    close(fd);
+    w->len = 0;
+}
+
+static bool open_segment(HeapWal *w) {
+    char path[PATH_MAX];
+    seg_path(w, w->seq, path, sizeof(path));
+    w->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC, 0644);
+    if (w->fd < 0) { perror(path); return false; }
+    sync_dir(w);
+    w->seg_bytes = 0;
+    return true;
+}
+
+static void flush_buf(HeapWal *w) {
+    if (w->len == 0) return;
+    if (!write_all(w->fd, w->buf, w->len)) { wal_fail(w, "WAL write"); return; }
+    w->seg_bytes += w->len;
+    w->len = 0;
+    w->dirty = true;
+}
+
+void wal_commit(HeapWal *w) {
+    if (!wal_on(w)) return;
+    flush_buf(w);
+    if (!wal_on(w) || !w->dirty) return;
+    if (fdatasync(w->fd) != 0) { wal_fail(w, "WAL fdatasync"); return; }
+    w->dirty = false;
+    w->commits++;
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &w->committed);
+}
+
+void wal_log(HeapWal *w, WalType t, uint32_t aux, int64_t expire, uint64_t key,
+             const char *name, size_t len) {
+    if (!wal_on(w)) return;
+    if (len > UINT16_MAX) len = UINT16_MAX;
+    WalRec r = make_rec(t, aux, expire, key, len);
+    r.crc = rec_crc(&r, name);
+
+    if (w->len + sizeof(r) + len > WAL_BUF_SIZE) {
+        flush_buf(w);
+        if (!wal_on(w)) return;
+    }
+    memcpy(w->buf + w->len, &r, sizeof(r));
+    if (len) memcpy(w->buf + w->len + sizeof(r), name, len);
+    w->len += sizeof(r) + len;
+    w->records++;
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &now);
+    if (elapsed_ms(&w->committed, &now) >= WAL_COMMIT_MS) wal_commit(w);
+}
+
+
+// ---- 스냅샷 ----
+// 백그라운드 스레드도 malloc을 쓰지 않는다 (_DEBUG_ 할당 검사는 프로세스 전체를 센다).
+// 압축에 쓰는 표/버퍼는 익명 mmap이다.
+static void *map_grow(void *p, size_t old_bytes, size_t bytes) {
+    void *np = p ? mremap(p, old_bytes, bytes, MREMAP_MAYMOVE)
+                 : mmap(NULL, bytes, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+    return np == MAP_FAILED ? NULL : np;
+}
+
+typedef struct {
+    char  *p;
+    size_t len, cap;
+} MapBuf;
+
+static bool buf_add(MapBuf *b, const void *data, size_t n) {
+    if (b->len + n > b->cap) {
+        size_t ncap = b->cap ? b->cap*2 : 64*1024;
+        while (ncap < b->len + n) ncap *= 2;
+        char *np = (char*)map_grow(b->p, b->cap, ncap);
+        if (!np) return false;
+        b->p = np; b->cap = ncap;
+    }
+    memcpy(b->p + b->len, data, n);
+    b->len += n;
+    return true;
+}
+
+static bool buf_rec(MapBuf *b, WalType t, uint32_t aux, int64_t expire, uint64_t key,
+                    const char *name, size_t len) {
+    if (len > UINT16_MAX) len = UINT16_MAX;
+    WalRec r = make_rec(t, aux, expire, key, len);
+    r.crc = rec_crc(&r, name);
+    return buf_add(b, &r, sizeof(r)) && (len == 0 || buf_add(b, name, len));
+}
+
+static void buf_free(MapBuf *b) {
+    if (b->p) munmap(b->p, b->cap);
+    memset(b, 0, sizeof(*b));
+}
+
+// (expire, key) 다중집합: open addressing, 개수가 0이 된 칸도 used로 남긴다
+typedef struct {
+    HeapEntry e;
+    uint32_t  used, n;
+} SetSlot;
+
+typedef struct {
+    SetSlot *s;
+    size_t   mask, used;
+} EntrySet;
+
+static size_t set_hash(HeapEntry e) {
+    uint64_t h = (e.key ^ (uint64_t)e.expire * 0x9E3779B97F4A7C15ull) * 0xBF58476D1CE4E5B9ull;
+    return (size_t)(h ^ (h >> 31));
+}
+
+static SetSlot *set_slot(const EntrySet *t, HeapEntry e) {
+    for (size_t i = set_hash(e) & t->mask; ; i = (i+1) & t->mask) {
+        SetSlot *s = &t->s[i];
+        if (!s->used || (s->e.expire == e.expire && s->e.key == e.key)) return s;
+    }
+}
+
+static bool set_add(EntrySet *t, HeapEntry e) {
+    if (2*(t->used+1) > (t->s ? t->mask+1 : 0)) {
+        size_t n = t->s ? 2*(t->mask+1) : 4096;
+        EntrySet nt = { (SetSlot*)map_grow(NULL, 0, n*sizeof(SetSlot)), n-1, t->used };
+        if (!nt.s) return false;
+        for (size_t i = 0; t->s && i <= t->mask; i++)
+            if (t->s[i].used) *set_slot(&nt, t->s[i].e) = t->s[i];
+        if (t->s) munmap(t->s, (t->mask+1)*sizeof(SetSlot));
+        *t = nt;
+    }
+    SetSlot *s = set_slot(t, e);
+    if (!s->used) { s->used = 1; s->e = e; s->n = 0; t->used++; }
+    s->n++;
+    return true;
+}
+
+// 있으면 하나 빼고 true
+static bool set_take(EntrySet *t, HeapEntry e) {
+    if (!t->s) return false;
+    SetSlot *s = set_slot(t, e);
+    if (!s->used || s->n == 0) return false;
+    s->n--;
+    return true;
+}
+
+static void set_free(EntrySet *t) {
+    if (t->s) munmap(t->s, (t->mask+1)*sizeof(SetSlot));
+    memset(t, 0, sizeof(*t));
+}
+
+// 스냅샷 파일 기록: 헤더, 메타, 엔트리(두 조각까지) -> fdatasync -> rename -> 세그먼트 정리
+static bool write_snapshot(HeapWal *w, uint64_t seq, const char *meta, size_t meta_len,
+                           const HeapEntry *a, size_t na, int (*emit)(HeapWal*, int), size_t nheap) {
+    char tmp[PATH_MAX], path[PATH_MAX];
+    snprintf(tmp, sizeof(tmp), "%s/snapshot.tmp", w->dir);
+    snprintf(path, sizeof(path), "%s/snapshot", w->dir);
+
+    int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) { perror(tmp); return false; }
+
+    SnapHdr h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, SNAP_MAGIC, sizeof(h.magic));
+    h.seq = seq;
+    h.ident = w->ident;
+    h.meta_len = meta_len;
+    h.nheap = nheap;
+
+    bool ok = write_all(fd, &h, sizeof(h)) && write_all(fd, meta, meta_len) &&
+              write_all(fd, a, na*sizeof(HeapEntry)) && (!emit || emit(w, fd) == 0) &&
+              fdatasync(fd) == 0;
+    if (!ok) perror(tmp);
+    close(fd);
+
+    // 그 사이 WAL이 실패했으면 rename하지 않는다 (검사와 rename을 wal_fail과 같은 잠금 아래서)
+    pthread_mutex_lock(&w->lock);
+    if (ok && __atomic_load_n(&w->fd, __ATOMIC_ACQUIRE) < 0) ok = false;
+    if (ok && rename(tmp, path) != 0) { perror(path); ok = false; }
+    pthread_mutex_unlock(&w->lock);
+    if (!ok) {
+        unlink(tmp);
+        return false;
+    }
+    sync_dir(w);
+
+    // 스냅샷에 들어간 세그먼트 정리
+    for (; w->oldest < seq; w->oldest++) {
+        seg_path(w, w->oldest, tmp, sizeof(tmp));
+        unlink(tmp);
+    }
+    return true;
+}
+
+void wal_base_rec(HeapWal *w, WalType t, uint32_t aux, int64_t expire, uint64_t key,
+                  const char *name, size_t len) {
+    MapBuf b = { w->meta, w->meta_len, w->meta_cap };
+    if (!buf_rec(&b, t, aux, expire, key, name, len)) perror("snapshot meta");
+    w->meta = b.p; w->meta_len = b.len; w->meta_cap = b.cap;
+}
+
+// 힙 배열을 그대로 기록한다. 삭제 루프가 돌기 전이므로 기다리게 할 것이 없다
+bool wal_base_end(HeapWal *w, const MinHeap *h) {
+    struct timespec t0, t1;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    bool ok = wal_on(w) && write_snapshot(w, w->seq, w->meta, w->meta_len, h->a, h->size, NULL, h->size);
+    MapBuf b = { w->meta, w->meta_len, w->meta_cap };
+    buf_free(&b);
+    w->meta = NULL; w->meta_len = w->meta_cap = 0;
+    if (!ok) return false;
+    w->has_base = true;
+    w->snap_at = time(NULL);
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    printf("Snapshot %llu: %zu entries (base), %.1f MB in %.2f s\n", (unsigned long long)w->seq,
+           h->size, (double)(sizeof(SnapHdr) + h->size*sizeof(HeapEntry)) / (1<<20),
+           elapsed_ms(&t0, &t1)/1e3);
+    return true;
+}
+
+// ---- 압축: 이전 스냅샷 + 세그먼트 [oldest, snap_seq) -> 새 스냅샷 ----
+typedef struct {
+    MapBuf   meta;      // 루트, device (이전 스냅샷 + WAL의 WAL_DEV)
+    MapBuf   retry;     // WAL_RETRY 레코드 (WAL_RETRY_DONE이면 뺀다)
+    EntrySet push;      // 구간에서 들어온 엔트리 (구간 안에서 pop되면 뺀다)
+    EntrySet pop;       // 구간에서 나간, 이전 스냅샷의 엔트리
+    const HeapEntry *old;
+    size_t   nold;
+} Compact;
+
+static bool compact_apply(void *arg, const WalRec *r, const char *name) {
+    Compact *c = (Compact*)arg;
+    HeapEntry e = { .expire = (time_t)r->expire, .key = r->key };
+    switch ((WalType)r->type) {
+        case WAL_ROOT:      // 둘 다 이전 스냅샷에서만 온다
+        case WAL_DEV:
+            return buf_rec(&c->meta, (WalType)r->type, r->aux, r->expire, r->key, name, r->len);
+        case WAL_PUSH:
+            return set_add(&c->push, e);
+        case WAL_POP:
+            return set_take(&c->push, e) || set_add(&c->pop, e);
+        case WAL_RETRY:
+            return buf_add(&c->retry, r, sizeof(*r));
+        case WAL_RETRY_DONE: {
+            WalRec *a = (WalRec*)c->retry.p;
+            size_t n = c->retry.len / sizeof(WalRec);
+            for (size_t i = 0; i < n; i++) {
+                if (a[i].key == r->key && a[i].aux == r->aux) {
+                    a[i] = a[n-1];
+                    c->retry.len -= sizeof(WalRec);
+                    return true;
+                }
+            }
+            return false;
+        }
+    }
+    return false;
+}
+
+static Compact *g_emit;     // emit 콜백용 (압축 스레드는 하나)
+
+// 살아남은 이전 엔트리(원래 순서 유지) 뒤에 새 엔트리를 붙인다
+static int emit_entries(HeapWal *w, int fd) {
+    Compact *c = g_emit;
+    size_t n = 0;
+    for (size_t i = 0; i < c->nold; i++) {
+        if (set_take(&c->pop, c->old[i])) continue;
+        memcpy(w->sbuf + n, &c->old[i], sizeof(HeapEntry));
+        if ((n += sizeof(HeapEntry)) + sizeof(HeapEntry) > WAL_BUF_SIZE) {
+            if (!write_all(fd, w->sbuf, n)) return -1;
+            n = 0;
+        }
+    }
+    for (size_t i = 0; c->push.s && i <= c->push.mask; i++) {
+        for (uint32_t k = 0; c->push.s[i].used && k < c->push.s[i].n; k++) {
+            memcpy(w->sbuf + n, &c->push.s[i].e, sizeof(HeapEntry));
+            if ((n += sizeof(HeapEntry)) + sizeof(HeapEntry) > WAL_BUF_SIZE) {
+                if (!write_all(fd, w->sbuf, n)) return -1;
+                n = 0;
+            }
+        }
+    }
+    return write_all(fd, w->sbuf, n) ? 0 : -1;
+}
+
+static size_t set_count(const EntrySet *t) {
+    size_t n = 0;
+    for (size_t i = 0; t->s && i <= t->mask; i++) if (t->s[i].used) n += t->s[i].n;
+    return n;
+}
+
+// 이전 스냅샷과 WAL이 맞지 않으면(없는 엔트리의 pop 등) 상태를 버린다: 다음 시작은 스캔
+static void compact_broken(HeapWal *w, const char *why) {
+    char path[PATH_MAX];
+    fprintf(stderr, " Warning: snapshot compaction: %s; state in %s dropped\n", why, w->dir);
+    snprintf(path, sizeof(path), "%s/snapshot", w->dir);
+    unlink(path);
+    __atomic_store_n(&w->broken, true, __ATOMIC_RELEASE);
+}
+
+static bool compact(HeapWal *w, size_t *nheap, size_t *nwal) {
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/snapshot", w->dir);
+    size_t n;
+    const char *p = map_file(path, &n);
+    SnapHdr h;
+    if (!p || n < sizeof(h)) { compact_broken(w, "snapshot missing"); return false; }
+    memcpy(&h, p, sizeof(h));
+
+    Compact c;
+    memset(&c, 0, sizeof(c));
+    unsigned long count = 0;
+    bool ok = false;
+    const char *why = "snapshot and WAL disagree";
+
+    // 이전 메타: 루트/device는 그대로, 재시도는 따로 모아 WAL을 적용한다
+    const char *m = p + sizeof(h), *mend = m + h.meta_len;
+    while (m < mend) {
+        WalRec r;
+        memcpy(&r, m, sizeof(r));
+        if (!compact_apply(&c, &r, m + sizeof(r))) goto out;
+        m += sizeof(r) + r.len;
+    }
+    c.old = (const HeapEntry*)(p + sizeof(h) + h.meta_len);
+    c.nold = h.nheap;
+
+    for (uint64_t s = w->oldest; s < w->snap_seq; s++) {
+        seg_path(w, s, path, sizeof(path));
+        size_t sn;
+        const char *q = map_file(path, &sn);
+        if (!q) { why = "WAL segment missing"; goto out; }
+        // 닫힌 세그먼트는 끝까지 온전해야 한다 (복구한 마지막 세그먼트는 wal_start가 잘라 둠)
+        size_t valid;
+        bool r = replay(q, sn, compact_apply, &c, &count, &valid);
+        if (sn) munmap((void*)q, sn);
+        if (!r) goto out;
+        if (valid != sn) { why = "damaged WAL segment"; goto out; }
+    }
+
+    size_t npop = set_count(&c.pop), npush = set_count(&c.push);
+    if (npop > c.nold) goto out;
+    if (!buf_add(&c.meta, c.retry.p, c.retry.len)) { why = "out of memory"; goto out; }
+    g_emit = &c;
+    ok = write_snapshot(w, w->snap_seq, c.meta.p, c.meta.len, NULL, 0, emit_entries,
+                        c.nold - npop + npush);
+    why = NULL;     // 기록 실패는 이전 스냅샷 + 세그먼트가 그대로 남으므로 상태는 유효
+    // 이전 스냅샷에 없던 엔트리를 pop 했다면 emit 후에도 pop 집합에 남는다
+    if (ok && set_count(&c.pop) != 0) { ok = false; why = "popped entries missing from the snapshot"; }
+    *nheap = c.nold - npop + npush;
+    *nwal = count;
+
+out:
+    if (!ok && why) compact_broken(w, why);
+    buf_free(&c.meta); buf_free(&c.retry);
+    set_free(&c.push); set_free(&c.pop);
+    munmap((void*)p, n);
+    return ok;
+}
+
+static void *snapshot_main(void *arg) {
+    HeapWal *w = (HeapWal*)arg;
+    pthread_mutex_lock(&w->lock);
+    for (;;) {
+        while (!w->busy && !w->quit) pthread_cond_wait(&w->cond, &w->lock);
+        if (!w->busy) break;
+        pthread_mutex_unlock(&w->lock);
+
+        struct timespec t0, t1;
+        clock_gettime(CLOCK_MONOTONIC, &t0);
+        size_t nheap = 0, nwal = 0;
+        if (compact(w, &nheap, &nwal)) {
+            clock_gettime(CLOCK_MONOTONIC, &t1);
+            printf("Snapshot %llu: %zu entries (%zu WAL records folded in) in %.2f s\n",
+                   (unsigned long long)w->snap_seq, nheap, nwal, elapsed_ms(&t0, &t1)/1e3);
+        }
+
+        pthread_mutex_lock(&w->lock);
+        w->busy = false;
+        pthread_cond_broadcast(&w->cond);
+    }
+    pthread_mutex_unlock(&w->lock);
+    return NULL;
+}
+
+bool wal_start(HeapWal *w) {
+    if (mkdir(w->dir, 0755) != 0 && errno != EEXIST) { perror(w->dir); return false; }
+    w->buf = (char*)malloc(WAL_BUF_SIZE);
+    w->sbuf = (char*)malloc(WAL_BUF_SIZE);
+    if (!w->buf || !w->sbuf) { perror("malloc"); return false; }
+    if (w->tail_seq) {      // 복구 때 본 잘린 꼬리를 잘라내야 이후 압축이 세그먼트 전체를 믿을 수 있다
+        char path[PATH_MAX];
+        seg_path(w, w->tail_seq, path, sizeof(path));
+        int fd = open(path, O_WRONLY | O_CLOEXEC);
+        bool ok = fd >= 0 && ftruncate(fd, (off_t)w->tail_len) == 0 && fdatasync(fd) == 0;
+        if (!ok) perror(path);
+        if (fd >= 0) close(fd);
+        if (!ok) return false;
+        w->tail_seq = 0;
+    }
+    if (!open_segment(w)) return false;
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &w->committed);
+    w->snap_at = time(NULL);
+    if (pthread_create(&w->thr, NULL, snapshot_main, w) != 0) {
+        perror("pthread_create");
+        close(w->fd);
+        w->fd = -1;
+        return false;
+    }
+    w->started = true;
+    return true;
+}
+
+bool wal_snapshot_due(HeapWal *w, time_t now) {
+    if (!wal_on(w)) return false;
+    if (__atomic_load_n(&w->broken, __ATOMIC_ACQUIRE)) {
+        close(w->fd);           // 스냅샷이 없으니 더 쓸 이유가 없다
+        w->fd = -1;
+        return false;
+    }
+    if (!w->has_base || __atomic_load_n(&w->busy, __ATOMIC_ACQUIRE)) return false;
+    return w->seg_bytes >= WAL_SNAPSHOT_BYTES || now - w->snap_at >= WAL_SNAPSHOT_SECS;
+}
+
+// 현재 세그먼트를 닫고 다음 세그먼트로 넘긴다. 새 스냅샷은 그 경계 시점의 상태
+bool wal_compact(HeapWal *w) {
+    if (!wal_on(w) || !w->has_base || __atomic_load_n(&w->busy, __ATOMIC_ACQUIRE)) return false;
+    wal_commit(w);
+    if (!wal_on(w)) return false;
+    close(w->fd);
+    w->seq++;
+    if (!open_segment(w)) { wal_fail(w, "WAL segment"); return false; }
+    w->snap_seq = w->seq;
+    w->snap_at = time(NULL);
+    pthread_mutex_lock(&w->lock);
+    w->busy = true;
+    pthread_cond_signal(&w->cond);
+    pthread_mutex_unlock(&w->lock);
+    return true;
+}
+
+void wal_stop(HeapWal *w) {
+    wal_commit(w);
+    if (w->started) {
+        pthread_mutex_lock(&w->lock);
+        w->quit = true;
+        pthread_cond_broadcast(&w->cond);
+        pthread_mutex_unlock(&w->lock);
+        pthread_join(w->thr, NULL);
+        w->started = false;
+    }
+    if (wal_on(w)) close(w->fd);
+    w->fd = -1;
+    free(w->buf); free(w->sbuf);
+    w->buf = w->sbuf = NULL;
+    MapBuf b = { w->meta, w->meta_len, w->meta_cap };
+    buf_free(&b);
+    w->meta = NULL;
+    pthread_mutex_destroy(&w->lock);
+    pthread_cond_destroy(&w->cond);
+}
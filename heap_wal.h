@@ -0,0 +1,110 @@
+#ifndef __HEAP_WAL_H__
+#define __HEAP_WAL_H__
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "min_heap.h"
+
+// ---- 힙 상태 영속화 (--state DIR) ----
+// 재시작할 때 nftw 전체 스캔 대신 "스냅샷 + WAL"로 힙과 재시도 큐를 되살린다.
+//   DIR/snapshot    : 헤더 + 메타 레코드(루트, device, 재시도) + HeapEntry 배열
+//   DIR/wal.<seq>   : 스냅샷 이후의 변경 레코드 (push / pop / 재시도 등록·완료)
+// 변경은 메모리 버퍼에 32B 레코드로 쌓고(push 1회 = 수십 ns), 주기 끝이나
+// WAL_COMMIT_MS마다 write + fdatasync 한 번으로 묶어서 커밋한다 (group commit).
+// 레코드는 지운 뒤에 기록하므로, 마지막 커밋 이후에 죽으면 그 삭제를 한 번 더 시도할 뿐이다.
+//
+// 기준 스냅샷은 스캔 직후, 삭제 루프가 돌기 전에 힙 배열을 그대로 써서 만든다 (wal_base_*).
+// 그 전에 죽으면 상태가 없으므로 다시 스캔한다 (스냅샷 없는 WAL은 쓰이지 않음).
+// 이후 스냅샷은 살아 있는 힙을 건드리지 않는다: 메인 스레드는 WAL을 다음 세그먼트로
+// 넘기기만 하고(wal_compact), 백그라운드 스레드가 이전 스냅샷을 읽으면서 그 사이
+// 세그먼트들의 pop은 빼고 push는 더해 새 스냅샷을 쓴다. 추가 메모리는 힙 크기가 아니라
+// 그 구간의 WAL 레코드 수에 비례하고, 삭제 루프는 세그먼트 교체 외에는 멈추지 않는다.
+// 엔트리는 정렬하지 않는다: 기준 스냅샷은 힙 배열 순서이고, 복구는 heap_push로 다시 쌓는다.
+
+#define WAL_BUF_SIZE        (64 * 1024)
+#define WAL_COMMIT_MS       200                 // 주기가 길어도 이 간격으로는 커밋
+#define WAL_SNAPSHOT_BYTES  (32u << 20)         // 세그먼트가 이만큼 쌓이면 스냅샷
+#define WAL_SNAPSHOT_SECS   3600                // 또는 마지막 스냅샷 후 이 시간이 지나면
+
+typedef enum {
+    WAL_PUSH = 1,       // expire, key
+    WAL_POP,            // expire, key (힙 top을 꺼내 처리함)
+    WAL_RETRY,          // expire = 다음 시도 시각, key, aux = 시도 횟수
+    WAL_RETRY_DONE,     // key, aux = 시도 횟수 (재시도 큐에서 꺼내 처리함)
+    WAL_DEV,            // key = device id, aux = 루트 id, name = "company/device" (스냅샷에만)
+    WAL_ROOT,           // aux = 루트 id, name = 루트 경로 (스냅샷에만)
+} WalType;
+
+typedef struct {
+    uint32_t crc;       // 나머지 필드 + name 의 FNV-1a
+    uint8_t  type;
+    uint8_t  pad;
+    uint16_t len;       // 레코드 뒤에 붙는 name 바이트 수
+    uint32_t aux;
+    int64_t  expire;
+    uint64_t key;
+} WalRec;               // 32B
+
+// 복구 중 레코드 하나 적용. false면 상태가 맞지 않는 것이므로 복구 중단
+typedef bool (*WalApplyFn)(void *arg, const WalRec *r, const char *name);
+
+typedef struct {
+    char     dir[256];
+    uint64_t ident;         // 설정 식별값: 다르면 저장된 상태를 쓰지 않는다 (만기 계산이 달라짐)
+    int      fd;            // 현재 세그먼트 (-1 = 기록 안 함)
+    uint64_t seq;           // 현재 세그먼트 번호
+    uint64_t tail_seq;      // 복구한 마지막 세그먼트의 꼬리가 잘려 있으면 그 번호 (0 = 없음)
+    size_t   tail_len;      // 그 세그먼트의 온전한 앞부분 길이
+    char    *buf;           // 그룹 커밋 버퍼 (WAL_BUF_SIZE)
+    size_t   len;
+    size_t   seg_bytes;     // 현재 세그먼트 크기
+    bool     dirty;         // write 했지만 fdatasync 전
+    struct timespec committed;
+    time_t   snap_at;       // 마지막 스냅샷 시작 시각
+    unsigned long records, commits;
+
+    // 스냅샷 (기준은 메인 스레드, 이후 압축은 백그라운드 스레드)
+    pthread_t       thr;
+    pthread_mutex_t lock;
+    pthread_cond_t  cond;
+    bool            started, busy, quit;
+    bool            broken;     // 압축이 WAL과 스냅샷이 맞지 않음을 발견 (상태 버림)
+    bool            has_base;   // DIR/snapshot이 있음 (복구했거나 wal_base_end)
+    char           *meta;       // 기준 스냅샷의 메타 레코드 (mmap, wal_base_rec)
+    size_t          meta_len, meta_cap;
+    uint64_t        snap_seq;
+    uint64_t        oldest;     // 아직 남아 있는 가장 오래된 세그먼트
+    char           *sbuf;       // 기록 버퍼 (WAL_BUF_SIZE)
+} HeapWal;
+
+void wal_init(HeapWal *w, const char *dir, uint64_t ident);
+
+// 스냅샷 + WAL을 순서대로 apply에 넘긴다. 스냅샷 안의 힙 엔트리는 WAL_PUSH로 온다.
+// 상태가 없거나(첫 실행), 설정이 바뀌었거나, 레코드가 맞지 않으면 false
+bool wal_recover(HeapWal *w, WalApplyFn apply, void *arg);
+
+// 저장된 상태를 지우고 (복구 실패 시) 기록 시작: 새 세그먼트 + 스냅샷 스레드
+void wal_reset(HeapWal *w);
+bool wal_start(HeapWal *w);
+void wal_stop(HeapWal *w);      // 커밋, 진행 중인 스냅샷 대기, 정리
+
+void wal_log(HeapWal *w, WalType t, uint32_t aux, int64_t expire, uint64_t key,
+             const char *name, size_t len);
+void wal_commit(HeapWal *w);    // write + fdatasync (쌓인 것이 있을 때만)
+
+// 기준 스냅샷 (wal_start 뒤, 삭제 시작 전, 동기 기록): 메타 레코드를 넣은 뒤 end
+void wal_base_rec(HeapWal *w, WalType t, uint32_t aux, int64_t expire, uint64_t key,
+                  const char *name, size_t len);
+bool wal_base_end(HeapWal *w, const MinHeap *h);
+
+// 주기적 스냅샷: 세그먼트를 넘기고 백그라운드 압축을 깨운다 (이전 것이 진행 중이면 false)
+bool wal_snapshot_due(HeapWal *w, time_t now);
+bool wal_compact(HeapWal *w);
+
+static inline bool wal_on(const HeapWal *w) { return w->fd >= 0; }
+
+#endif //__HEAP_WAL_H__
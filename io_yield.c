@@ -0,0 +1,158 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "io_yield.h"
+
+// <linux/ioprio.h> is not installed everywhere
+#define IOPRIO_CLASS_SHIFT  13
+#define IOPRIO_CLASS_IDLE   3
+#define IOPRIO_WHO_PROCESS  1
+
+bool iy_idle_thread(void)
+{
+  // who 0 with IOPRIO_WHO_PROCESS is the calling thread: priorities are per thread
+  return syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0,
+      IOPRIO_CLASS_IDLE << IOPRIO_CLASS_SHIFT) == 0;
+}
+
+
+static bool write_file(const char *dir, const char *name, const char *text)
+{
+  char path[PATH_MAX];
+  if (snprintf(path, sizeof(path), "%s/%s", dir, name) >= (int)sizeof(path)) {
+    errno = ENAMETOOLONG;
+    return false;
+  }
+
+  int fd = open(path, O_WRONLY | O_CLOEXEC);
+  if (fd < 0) {
+    int err = errno;
+    fprintf(stderr, " Warning: %s: %s\n", path, strerror(err));
+    errno = err;
+    return false;
+  }
+  // cgroup files take one write; a short one is an error
+  size_t len = strlen(text);
+  bool ok = (write(fd, text, len) == (ssize_t)len);
+  if (!ok)
+    fprintf(stderr, " Warning: writing \"%s\" to %s: %s\n", text, path, strerror(errno));
+  close(fd);
+  return ok;
+}
+
+
+bool iy_join_cgroup(const char *dir, const char *io_max)
+{
+  if (mkdir(dir, 0755) != 0 && errno != EEXIST) {
+    fprintf(stderr, " Warning: %s: %s\n", dir, strerror(errno));
+    return false;
+  }
+
+  // limit first, so nothing runs in the group unlimited
+  if (io_max && !write_file(dir, "io.max", io_max)) {
+    if (errno == ENOENT)
+      fprintf(stderr, " Warning: no io.max: \"+io\" missing from the parent's cgroup.subtree_control\n");
+    return false;
+  }
+
+  char pid[32];
+  snprintf(pid, sizeof(pid), "%ld", (long)getpid());
+  return write_file(dir, "cgroup.procs", pid);
+}
+
+
+// "some avg10=1.23 avg60=0.50 avg300=0.10 total=12345"
+bool iy_psi_read(const char *path, double *avg10)
+{
+  char buf[256];
+  int fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0)
+    return false;
+  ssize_t n = read(fd, buf, sizeof(buf) - 1);
+  close(fd);
+  if (n <= 0)
+    return false;
+  buf[n] = '\0';
+
+  const char *p = strstr(buf, "some avg10=");
+  if (p == NULL)
+    return false;
+  char *end;
+  double v = strtod(p + strlen("some avg10="), &end);
+  if (end == p + strlen("some avg10="))
+    return false;
+  *avg10 = v;
+  return true;
+}
+
+
+bool iy_psi_init(IY_PSI *p, const char *path, double limit)
+{
+  memset(p, 0, sizeof(*p));
+  pthread_mutex_init(&p->lock, NULL);
+  p->path = path;
+  if (limit <= 0)
+    return true;
+
+  double v;
+  if (!iy_psi_read(path, &v))
+    return false;   // no PSI in this kernel (CONFIG_PSI, psi=1)
+  p->limit = limit;
+  return true;
+}
+
+
+void iy_psi_free(IY_PSI *p)
+{
+  pthread_mutex_destroy(&p->lock);
+}
+
+
+static double elapsed(const struct timespec *a, const struct timespec *b)
+{
+  return (double)(b->tv_sec - a->tv_sec) + (double)(b->tv_nsec - a->tv_nsec) / 1e9;
+}
+
+
+void iy_psi_wait(IY_PSI *p)
+{
+  if (p->limit <= 0)
+    return;
+
+  for (;;) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    // one reader per poll interval; the others use its answer
+    pthread_mutex_lock(&p->lock);
+    double v;
+    if (elapsed(&p->checked, &now) * 1000 >= IY_PSI_POLL_MS && iy_psi_read(p->path, &v)) {
+      p->checked = now;
+      bool over = (v > p->limit);
+      if (over && !p->over) {
+        p->pauses++;
+        p->paused_at = now;
+        printf("io pressure %.2f%% > %.2f%%: deletion paused\n", v, p->limit);
+      }
+      else if (!over && p->over) {
+        double sec = elapsed(&p->paused_at, &now);
+        p->paused_sec += sec;
+        printf("io pressure %.2f%%: deletion resumed after %.1f s\n", v, sec);
+      }
+      p->over = over;
+    }
+    bool over = p->over;
+    pthread_mutex_unlock(&p->lock);
+
+    if (!over)
+      return;
+    usleep(IY_PSI_POLL_MS * 1000);
+  }
+}
@@ -0,0 +1,46 @@
+#ifndef __IO_YIELD_H__
+#define __IO_YIELD_H__
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <time.h>
+
+// Background mode: give way to co-located writers (--background).
+//  - IOPRIO_CLASS_IDLE for the calling thread (ioprio_set); only schedulers
+//    with priority classes (BFQ) honour it
+//  - optionally run inside a cgroup v2 directory, with an io.max limit
+//  - pause while the io pressure (PSI "some avg10", /proc/pressure/io) is
+//    above a threshold, the part that works whatever the scheduler
+
+#define IY_PSI_PATH     "/proc/pressure/io"
+#define IY_PSI_DEFAULT  10.0    // % of time some task waited on I/O, 10 s mean
+#define IY_PSI_POLL_MS  1000    // the kernel updates avg10 every 2 s
+
+typedef struct tagIY_PSI {
+  double limit;           // pause above this avg10; 0: off
+  const char *path;
+  bool over;              // as of the last read
+  struct timespec checked, paused_at;
+  unsigned long pauses;
+  double paused_sec;      // total, over all pauses
+  pthread_mutex_t lock;
+} IY_PSI;
+
+// IOPRIO_CLASS_IDLE for this thread; false (errno set) if refused
+bool iy_idle_thread(void);
+
+// move this process into cgroup v2 directory dir (created if missing) and,
+// if io_max is not NULL, write it to dir/io.max ("MAJ:MIN wiops=N ...")
+bool iy_join_cgroup(const char *dir, const char *io_max);
+
+// limit <= 0 turns it off; false if path cannot be read (then it is off too)
+bool iy_psi_init(IY_PSI *p, const char *path, double limit);
+void iy_psi_free(IY_PSI *p);
+
+// the "some avg10" value of a pressure file
+bool iy_psi_read(const char *path, double *avg10);
+
+// return at once while pressure is low; otherwise sleep until it drops
+void iy_psi_wait(IY_PSI *p);
+
+#endif //__IO_YIELD_H__
@@ -0,0 +1,165 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "job_queue.h"
+
+bool jq_init(JOB_QUEUE *q, size_t capacity)
+{
+  size_t cap = 2;
+  while (cap < capacity)
+    cap *= 2;
+
+  memset(q, 0, sizeof(*q));
+  q->cell = (JQ_CELL *)malloc(cap * sizeof(JQ_CELL));
+  if (q->cell == NULL)
+    return false;
+  for (size_t i = 0; i < cap; i++)
+    q->cell[i].seq = i;
+  q->mask = cap - 1;
+  pthread_mutex_init(&q->lock, NULL);
+  pthread_cond_init(&q->not_full, NULL);
+  pthread_cond_init(&q->not_empty, NULL);
+  return true;
+}
+
+
+void jq_free(JOB_QUEUE *q)
+{
+  free(q->cell);
+  pthread_mutex_destroy(&q->lock);
+  pthread_cond_destroy(&q->not_full);
+  pthread_cond_destroy(&q->not_empty);
+  memset(q, 0, sizeof(*q));
+}
+
+
+// A cell is free for the push at position pos when seq == pos, and holds the
+// item for the pop at pos when seq == pos + 1.
+bool jq_try_push(JOB_QUEUE *q, void *data)
+{
+  size_t pos = __atomic_load_n(&q->head, __ATOMIC_RELAXED);
+  for (;;) {
+    JQ_CELL *c = &q->cell[pos & q->mask];
+    size_t seq = __atomic_load_n(&c->seq, __ATOMIC_ACQUIRE);
+    intptr_t dif = (intptr_t)seq - (intptr_t)pos;
+    if (dif == 0) {
+      if (__atomic_compare_exchange_n(&q->head, &pos, pos + 1, true,
+            __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+        c->data = data;
+        __atomic_store_n(&c->seq, pos + 1, __ATOMIC_RELEASE);
+        return true;
+      }
+    }
+    else if (dif < 0) {
+      return false;   // full
+    }
+    else {
+      pos = __atomic_load_n(&q->head, __ATOMIC_RELAXED);
+    }
+  }
+}
+
+
+bool jq_try_pop(JOB_QUEUE *q, void **data)
+{
+  size_t pos = __atomic_load_n(&q->tail, __ATOMIC_RELAXED);
+  for (;;) {
+    JQ_CELL *c = &q->cell[pos & q->mask];
+    size_t seq = __atomic_load_n(&c->seq, __ATOMIC_ACQUIRE);
+    intptr_t dif = (intptr_t)seq - (intptr_t)(pos + 1);
+    if (dif == 0) {
+      if (__atomic_compare_exchange_n(&q->tail, &pos, pos + 1, true,
+            __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+        *data = c->data;
+        __atomic_store_n(&c->seq, pos + q->mask + 1, __ATOMIC_RELEASE);
+        return true;
+      }
+    }
+    else if (dif < 0) {
+      return false;   // empty
+    }
+    else {
+      pos = __atomic_load_n(&q->tail, __ATOMIC_RELAXED);
+    }
+  }
+}
+
+
+size_t jq_size(const JOB_QUEUE *q)
+{
+  size_t head = __atomic_load_n(&q->head, __ATOMIC_RELAXED);
+  size_t tail = __atomic_load_n(&q->tail, __ATOMIC_RELAXED);
+  return (head > tail) ? head - tail : 0;
+}
+
+
+// Wake one sleeper on cv if there is any. The seq_cst fence pairs with the
+// waiter's seq_cst increment: either the waiter's retry sees the item just
+// moved, or this sees the waiter and its wait has released the lock first.
+static void wake(JOB_QUEUE *q, int *waiters, pthread_cond_t *cv)
+{
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  if (__atomic_load_n(waiters, __ATOMIC_RELAXED) == 0)
+    return;
+  pthread_mutex_lock(&q->lock);
+  pthread_cond_signal(cv);
+  pthread_mutex_unlock(&q->lock);
+}
+
+
+void jq_push(JOB_QUEUE *q, void *data)
+{
+  size_t occ = jq_size(q);
+  if (occ > q->mask)
+    occ = q->mask;    // head and tail are read apart
+  __atomic_fetch_add(&q->stat.pushed, 1, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&q->stat.occupancy_sum, occ, __ATOMIC_RELAXED);
+  size_t peak = __atomic_load_n(&q->stat.peak, __ATOMIC_RELAXED);
+  while (occ + 1 > peak &&
+      !__atomic_compare_exchange_n(&q->stat.peak, &peak, occ + 1, true,
+        __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+    ;
+
+  if (!jq_try_push(q, data)) {
+    __atomic_fetch_add(&q->stat.full_waits, 1, __ATOMIC_RELAXED);
+    pthread_mutex_lock(&q->lock);
+    __atomic_fetch_add(&q->push_waiters, 1, __ATOMIC_SEQ_CST);
+    while (!jq_try_push(q, data))
+      pthread_cond_wait(&q->not_full, &q->lock);
+    __atomic_fetch_sub(&q->push_waiters, 1, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&q->lock);
+  }
+  wake(q, &q->pop_waiters, &q->not_empty);
+}
+
+
+bool jq_pop(JOB_QUEUE *q, void **data)
+{
+  bool ok = jq_try_pop(q, data);
+  if (!ok) {
+    __atomic_fetch_add(&q->stat.empty_waits, 1, __ATOMIC_RELAXED);
+    pthread_mutex_lock(&q->lock);
+    __atomic_fetch_add(&q->pop_waiters, 1, __ATOMIC_SEQ_CST);
+    for (;;) {
+      // closed is set under the lock, after the last push
+      if ((ok = jq_try_pop(q, data)) || q->closed)
+        break;
+      pthread_cond_wait(&q->not_empty, &q->lock);
+    }
+    __atomic_fetch_sub(&q->pop_waiters, 1, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&q->lock);
+    if (!ok)
+      return false;
+  }
+  wake(q, &q->push_waiters, &q->not_full);
+  return true;
+}
+
+
+void jq_close(JOB_QUEUE *q)
+{
+  pthread_mutex_lock(&q->lock);
+  __atomic_store_n(&q->closed, 1, __ATOMIC_RELEASE);
+  pthread_cond_broadcast(&q->not_empty);
+  pthread_mutex_unlock(&q->lock);
+}
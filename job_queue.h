@@ -0,0 +1,59 @@
+#ifndef __JOB_QUEUE_H__
+#define __JOB_QUEUE_H__
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Bounded lock-free MPMC queue of pointers (per-cell sequence numbers, after
+// Vyukov). Producers and consumers only contend on their own index; the
+// capacity bounds memory and is the backpressure: a producer facing a full
+// queue waits for the consumers instead of running ahead of them. Waiting
+// sides sleep on a condition variable; the other side takes the lock only
+// when it sees a waiter, so the uncontended path stays lock-free.
+
+typedef struct tagJQ_CELL {
+  size_t seq;
+  void *data;
+} JQ_CELL;
+
+typedef struct tagJQ_STAT {
+  unsigned long pushed;
+  unsigned long full_waits;     // pushes that found the queue full
+  unsigned long empty_waits;    // pops that found it empty
+  unsigned long occupancy_sum;  // occupancy seen by each push, for the mean
+  size_t peak;
+} JQ_STAT;
+
+typedef struct tagJOB_QUEUE {
+  JQ_CELL *cell;
+  size_t mask;                  // capacity - 1, capacity a power of two
+  size_t head __attribute__((aligned(64)));   // next push
+  size_t tail __attribute__((aligned(64)));   // next pop
+  int closed __attribute__((aligned(64)));
+  int push_waiters;             // threads asleep on not_full / not_empty
+  int pop_waiters;
+  pthread_mutex_t lock;         // only for sleeping and waking
+  pthread_cond_t not_full;
+  pthread_cond_t not_empty;
+  JQ_STAT stat;                 // updated with atomic adds
+} JOB_QUEUE;
+
+bool jq_init(JOB_QUEUE *q, size_t capacity);
+void jq_free(JOB_QUEUE *q);
+
+bool jq_try_push(JOB_QUEUE *q, void *data);
+bool jq_try_pop(JOB_QUEUE *q, void **data);
+
+// blocking forms: push waits while full; pop waits while empty and returns
+// false once the queue is closed and drained
+void jq_push(JOB_QUEUE *q, void *data);
+bool jq_pop(JOB_QUEUE *q, void **data);
+
+// no more pushes; consumers finish what is queued and return
+void jq_close(JOB_QUEUE *q);
+
+size_t jq_size(const JOB_QUEUE *q);
+
+#endif //__JOB_QUEUE_H__
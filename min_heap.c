@@ -0,0 +1,117 @@
+#define _GNU_SOURCE     // mremap
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "min_heap.h"
+
+static int entry_less(const HeapEntry *x, const HeapEntry *y) {
+    if (x->expire != y->expire) return x->expire < y->expire;
+    return x->key < y->key;
+}
+
+void heap_init(MinHeap *h) { heap_init_arity(h, HEAP_DEFAULT_ARITY); }
+
+bool heap_init_arity(MinHeap *h, unsigned arity) {
+    h->base=NULL; h->a=NULL; h->size=0; h->cap=0;
+    h->map_bytes=0; h->resident=0; h->release=false;
+    h->d=HEAP_DEFAULT_ARITY; h->shift=(unsigned)__builtin_ctz(HEAP_DEFAULT_ARITY);
+    // 2..8, 2의 거듭제곱만 (잘못된 값이면 기본 arity 유지하고 false)
+    if (arity < 2 || arity > 8 || (arity & (arity-1)) != 0) return false;
+    h->d = arity;
+    h->shift = (unsigned)__builtin_ctz(arity);
+    return true;
+}
+
+static size_t page_round(size_t bytes) {
+    static size_t pg;
+    if (!pg) pg = (size_t)sysconf(_SC_PAGESIZE);
+    return (bytes + pg - 1) & ~(pg - 1);
+}
+
+// 용량은 2배씩 (mremap 횟수를 줄이려고). 새 매핑이든 mremap이든 엔트리는 복사하지 않는다
+bool heap_reserve(MinHeap *h, size_t need) {
+    if (h->cap >= need) return true;
+    size_t ncap = h->cap ? h->cap*2 : 256;
+    if (ncap < need) ncap = need;
+
+    size_t pad = h->d - 1;
+    size_t bytes = page_round((ncap+pad)*sizeof(HeapEntry));
+    void *nb = h->base
+        ? mremap(h->base, h->map_bytes, bytes, MREMAP_MAYMOVE)
+        : mmap(NULL, bytes, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+    if (nb == MAP_FAILED) return false;
+
+    h->base = (HeapEntry*)nb;
+    h->a = h->base + pad;
+    h->map_bytes = bytes;
+    h->cap = bytes/sizeof(HeapEntry) - pad;   // 페이지 끝까지 쓴다
+    return true;
+}
+
+void heap_set_release(MinHeap *h, bool on) { h->release = on; }
+
+// size의 2배 위쪽 페이지를 돌려준다 (바로 다시 커질 여유는 남긴다)
+static void release_tail(MinHeap *h) {
+    size_t pad = h->d - 1;
+    size_t keep = page_round((pad + h->size*2)*sizeof(HeapEntry));
+    size_t used = page_round((pad + h->resident)*sizeof(HeapEntry));
+    if (used > h->map_bytes) used = h->map_bytes;
+    if (keep >= used || used - keep < HEAP_RELEASE_MIN) return;
+    if (madvise((char*)h->base + keep, used - keep, MADV_DONTNEED) == 0)
+        h->resident = h->size*2;
+}
+
+bool heap_push(MinHeap *h, HeapEntry e) {
+    if (!heap_reserve(h, h->size+1)) return false;
+    HeapEntry *a = h->a;
+    size_t i = h->size++;
+    if (h->size > h->resident) h->resident = h->size;
+    // up-heap: swap 대신 빈 자리(hole)를 위로 올린다
+    while (i>0) {
+        size_t p = (i-1) >> h->shift;
+        if (!entry_less(&e, &a[p])) break;
+        a[i] = a[p]; i = p;
+    }
+    a[i] = e;
+    return true;
+}
+
+bool heap_peek(const MinHeap *h, HeapEntry *out) {
+    if (h->size==0) return false;
+    if (out) *out = h->a[0];
+    return true;
+}
+
+bool heap_pop(MinHeap *h, HeapEntry *out) {
+    if (h->size==0) return false;
+    HeapEntry *a = h->a;
+    if (out) *out = a[0];
+    HeapEntry last = a[--h->size];
+    size_t n = h->size;
+    if (h->release && n < h->resident/4) release_tail(h);
+    if (n == 0) return true;
+
+    // down-heap: 자식 그룹(정렬된 d칸)에서 최소를 찾아 hole을 내린다
+    size_t i=0;
+    for (;;) {
+        size_t c = (i << h->shift) + 1;
+        if (c >= n) break;
+        size_t end = c + h->d;
+        if (end > n) end = n;
+        size_t s = c;
+        for (size_t k=c+1; k<end; k++)
+            if (entry_less(&a[k], &a[s])) s=k;
+        if (!entry_less(&a[s], &last)) break;
+        a[i] = a[s]; i = s;
+    }
+    a[i] = last;
+    return true;
+}
+
+void heap_free(MinHeap *h) {
+    if (h->base) munmap(h->base, h->map_bytes);
+    h->base=NULL; h->a=NULL; h->size=h->cap=0;
+    h->map_bytes=0; h->resident=0;
+}
@@ -1,7 +1,12 @@
+// Build:
+//   gcc -O2 -Wall -pthread -o min_heap_retention_process min_heap_retention_process.c min_heap.c dir_purge.c path_key.c retn_config.c heap_wal.c
+
+#define _GNU_SOURCE
 #define _XOPEN_SOURCE 700
 #include <ftw.h>
 #include <dirent.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <time.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -10,185 +15,572 @@
 #include <libgen.h>   // dirname
 #include <limits.h>
 #include <unistd.h>
+#include <getopt.h>
+#include <sys/stat.h>
+
+#include "date_parse.h"
+#include "dir_purge.h"
+#include "heap_wal.h"
+#include "min_heap.h"
+#include "path_key.h"
+#include "path_schema.h"
+#include "retn_config.h"
 
 // ---- 글로벌 옵션들 ----
-static const char *g_root_path = "/data";   // 옵션/설정에서 세팅
+// -r 옵션 (여러 번 지정 가능: 볼륨마다 하나씩, 깊이 무관). 없으면 /data
+#define MAX_ROOTS 256
+static PS_ROOTDIR g_roots[MAX_ROOTS];
+static uint32_t g_nroots = 0;
+static uint32_t g_cur_root;   // 지금 스캔 중인 루트 (= PathIntern 루트 id)
 static bool gDry_run = false;
-static long gRetention_secs = 30L * 24 * 3600; // 예: 30일 (config.json에서 로드해 대체)
+static RETN_CONFIG g_cfg;   // config.json: 회사별 보존 일수 + 만기 단위(granularity)
+static PathIntern g_keys;   // company/device 인턴 테이블 (HeapEntry.key 해석용)
+static HeapWal g_wal = { .fd = -1 };   // --state: 힙 변경 WAL + 스냅샷 (heap_wal.h)
 
-// ---- Heap 엔트리 ----
-typedef struct {
-    time_t expire;
-    char  *path;   // 삭제할 "디렉터리"의 절대경로 (분 단위 디렉터리)
-} HeapEntry;
+// ---- 경로에서 시간 파싱: <root>/company/device/YYYY/MM/DD/HH/mm ----
+// 키에서 경로를 다시 만들 수 있어야 하므로 고정 폭 숫자(4/2/2/2/2)만 허용한다.
+// 현재 루트 기준(path_schema.h)으로 company/device/YYYY/MM[/DD[/HH[/mm]]]를 복사 없이 자른다.
+// 성공 시 true, out_key에 압축 키, out_epoch에 단위 시작의 UTC epoch 저장
+static bool parse_unit_path(const char *path, size_t path_len, PkGran gran,
+                            uint64_t *out_key, time_t *out_epoch) {
+    const char *beg[PS_NLEVEL - 1]; size_t len[PS_NLEVEL - 1];
+    int level = ps_split(&g_roots[g_cur_root], path, path_len, beg, len);
+    if (level != ps_unit_level((int)gran)) return false;
 
-typedef struct {
-    HeapEntry *a;
-    size_t size, cap;
-} MinHeap;
+    // YYYY/MM[/DD[/HH[/mm]]] 고정 폭 숫자 + 범위(일은 그 달의 일수까지) 검사
+    int v[DP_NCOMP];
+    if (dp_parse_date(beg + PS_YEAR - 1, len + PS_YEAR - 1, level - PS_YEAR + 1, v) >= 0)
+        return false;
 
-static void heap_init(MinHeap *h) { h->a=NULL; h->size=0; h->cap=0; }
+    struct tm tmv = {0};
+    tmv.tm_year = v[DP_YEAR] - 1900;
+    tmv.tm_mon  = v[DP_MONTH] - 1;
+    tmv.tm_mday = v[DP_DAY];
+    tmv.tm_hour = v[DP_HOUR];
+    tmv.tm_min  = v[DP_MINUTE];
+    tmv.tm_sec  = 0;
 
-static int entry_less(const HeapEntry *x, const HeapEntry *y) {
-    if (x->expire != y->expire) return x->expire < y->expire;
-    return strcmp(x->path, y->path) < 0;
-}
+    // rm_retention.c 와 같이 UTC 기준 (키의 분 값을 gmtime으로 되돌리므로 필수)
+    time_t t = timegm(&tmv);
+    if (t == (time_t)-1 || t < 0 || t/60 > PK_MINUTE_MAX) return false;
 
-static void heap_swap(HeapEntry *x, HeapEntry *y) {
-    HeapEntry t=*x; *x=*y; *y=t;
-}
+    int64_t dev = pk_intern(&g_keys, g_cur_root, beg[PS_COMPANY - 1], len[PS_COMPANY - 1],
+                            beg[PS_DEVICE - 1], len[PS_DEVICE - 1]);
+    if (dev < 0) return false;
 
-static void heap_reserve(MinHeap *h, size_t need) {
-    if (h->cap >= need) return;
-    size_t ncap = h->cap ? h->cap*2 : 256;
-    if (ncap < need) ncap = need;
-    h->a = (HeapEntry*)realloc(h->a, ncap*sizeof(HeapEntry));
-    h->cap = ncap;
+    *out_key = pk_make((uint32_t)dev, gran, (uint32_t)(t/60));
+    *out_epoch = t;
+    return true;
 }
 
-static void heap_push(MinHeap *h, HeapEntry e) {
-    heap_reserve(h, h->size+1);
-    size_t i = h->size++;
-    h->a[i] = e;
-    // up-heap
-    while (i>0) {
-        size_t p = (i-1)/2;
-        if (!entry_less(&h->a[i], &h->a[p])) break;
-        heap_swap(&h->a[i], &h->a[p]); i = p;
+// ---- nftw 콜백에서 "만기 단위 디렉토리"만 힙에 등록 ----
+// 회사별 granularity(월/일/시/분) 깊이의 디렉터리 하나당 엔트리 1개만 둔다.
+// (기본은 rm_retention.c 와 같은 일 단위 -> 분 단위 대비 최대 1440배 적은 엔트리)
+// 단위 디렉터리 아래는 FTW_SKIP_SUBTREE로 건너뛰고, 하위 디렉터리는 만기 시점에
+// 삭제 워커가 펼친다. 월 단위 회사는 스캔도 월 디렉터리에서 멈춘다.
+// level: 0=root 1=company 2=device 3=YYYY 4=MM 5=DD 6=HH 7=mm  (path_schema.h, 단위 = 7 - gran)
+static MinHeap g_heap;
+// 정책은 회사(level 1) -> device(level 2) 두 단계 해시로 찾고, nftw가 회사/device
+// 단위로 연속 방문하므로 디렉터리에 들어갈 때 한 번만 찾아 아래 서브트리에서 재사용한다.
+static const RETN_COMPANY *g_cur_company;  // 현재 스캔 중인 회사 (NULL: 설정 없음)
+static RETN_POLICY g_cur_policy;           // 현재 스캔 중인 device의 정책
+static unsigned long g_malformed;          // 형식이 틀린 날짜 디렉터리 수
+
+static int cb_register_unit_dir(const char *fpath, const struct stat *sb, int typeflag, struct FTW *ftwbuf) {
+    (void)sb;
+    if (typeflag != FTW_D) return FTW_CONTINUE;   // 디렉토리만 고려
+    const char *name = fpath + ftwbuf->base;
+    if (ftwbuf->level == PS_COMPANY) {
+        g_cur_company = retn_find_company(&g_cfg, name, strlen(name));
+        return FTW_CONTINUE;
     }
+    if (ftwbuf->level == PS_DEVICE) {
+        g_cur_policy = retn_device_policy(&g_cfg, g_cur_company, name, strlen(name));
+        return FTW_CONTINUE;
+    }
+
+    PkGran gran = (PkGran)g_cur_policy.granularity;
+    int unit_level = ps_unit_level((int)gran);
+    if (ftwbuf->level < unit_level) {
+        // 단위 위의 연/월/일/시 디렉터리도 이름만 검사해서 엉뚱한 서브트리로 내려가지 않는다
+        int v;
+        if (ftwbuf->level >= PS_YEAR &&
+            !dp_component(ps_date_comp(ftwbuf->level), name, strlen(name), &v)) {
+            g_malformed++;
+            fprintf(stderr, " Warning: skipping malformed date directory: %s\n", fpath);
+            return FTW_SKIP_SUBTREE;
+        }
+        return FTW_CONTINUE;
+    }
+
+    time_t create_epoch;
+    uint64_t key;
+    if (ftwbuf->level != unit_level) return FTW_SKIP_SUBTREE;
+    if (!parse_unit_path(fpath, (size_t)ftwbuf->base + strlen(name), gran, &key, &create_epoch)) {
+        // "2025x", "abc" 같은 이름은 날짜를 추측하지 않고 건너뛴 뒤 개수만 센다
+        g_malformed++;
+        fprintf(stderr, " Warning: skipping malformed date directory: %s\n", fpath);
+    }
+    else {
+        time_t expire = retn_unit_expire(create_epoch, g_cur_policy.granularity,
+                                         g_cur_policy.retention_days);
+        // 모든 device의 하루가 00:00 UTC에 한꺼번에 만기되지 않도록
+        // device마다 고정된 지연(0 ~ spread_window)을 더한다. 일찍 지우는 일은 없다.
+        if (g_cfg.spread_window > 0)
+            expire += (time_t)(pk_dev_hash(&g_keys, key) % (uint32_t)g_cfg.spread_window);
+
+        // 엔트리 등록 (경로 문자열은 저장하지 않음)
+        HeapEntry e = { .expire = expire, .key = key };
+        if (!heap_push(&g_heap, e))
+            perror("heap_push");
+    }
+    return FTW_SKIP_SUBTREE;
 }
 
-static bool heap_peek(MinHeap *h, HeapEntry *out) {
-    if (h->size==0) return false;
-    if (out) *out = h->a[0];
-    return true;
+// ---- 재시도 큐 (쓰기 중인 디렉터리 전용) ----
+// 메인 힙에는 새 작업만 둔다. 비어있지 않은 디렉터리는 워커가 직접 비우므로
+// 여기로 오는 것은 아직 파일이 쓰이고 있는(busy) 디렉터리뿐이다.
+// 개수가 적으므로 선형 배열로 충분하고, 지수 백오프(상한 RETRY_MAX_SECS)를 둔다.
+// 만기된 디렉터리는 재스캔이 없으므로 절대 버리지 않는다: 횟수 상한을 넘으면 경고만 하고
+// 상한 간격으로 계속 시도하며, 큐가 가득 차면 같은 간격 뒤로 메인 힙에 다시 넣는다.
+#define RETRY_BASE_SECS     60
+#define RETRY_MAX_SECS      3600
+#define RETRY_MAX_ATTEMPTS  8       // 이 횟수를 넘으면 경고 (재시도는 계속)
+#define RETRY_QUEUE_MAX     4096
+
+typedef struct {
+    HeapEntry e;          // e.expire = 다음 재시도 시각
+    unsigned  attempts;
+} RetryEntry;
+
+typedef struct {
+    RetryEntry *a;        // RETRY_QUEUE_MAX+1칸을 시작할 때 한 번만 할당 (+1: WAL 재생 중 잠깐 넘침)
+    size_t n;
+} RetryQueue;
+
+static RetryQueue g_retry;
+static const PURGE_OPT g_purge_opt_default = { .busy_grace = 120 };
+static PURGE_OPT g_purge_opt;
+
+static time_t retry_backoff(unsigned attempts) {
+    time_t d = RETRY_BASE_SECS;
+    while (attempts-- > 1 && d < RETRY_MAX_SECS) d *= 2;
+    return d < RETRY_MAX_SECS ? d : RETRY_MAX_SECS;
 }
 
-static bool heap_pop(MinHeap *h, HeapEntry *out) {
-    if (h->size==0) return false;
-    if (out) *out = h->a[0];
-    h->a[0] = h->a[--h->size];
-    // down-heap
-    size_t i=0;
-    for (;;) {
-        size_t l=2*i+1, r=2*i+2, s=i;
-        if (l<h->size && entry_less(&h->a[l], &h->a[s])) s=l;
-        if (r<h->size && entry_less(&h->a[r], &h->a[s])) s=r;
-        if (s==i) break;
-        heap_swap(&h->a[i], &h->a[s]); i=s;
+static void retry_schedule(HeapEntry e, unsigned attempts, time_t now) {
+    if (attempts == RETRY_MAX_ATTEMPTS + 1)
+        fprintf(stderr, "Still busy after %u attempts, retrying every %d s: %s\n",
+                attempts-1, RETRY_MAX_SECS, pk_path(&g_keys, e.key));
+    e.expire = now + retry_backoff(attempts);
+    if (g_retry.n >= RETRY_QUEUE_MAX) {
+        // 큐가 가득 참: 상한 간격 뒤로 힙에 다시 넣는다 (시도 횟수는 처음부터)
+        e.expire = now + RETRY_MAX_SECS;
+        if (!heap_push(&g_heap, e)) {
+            perror("heap_push");
+            return;
+        }
+        wal_log(&g_wal, WAL_PUSH, 0, e.expire, e.key, NULL, 0);
+        return;
     }
-    return true;
+    g_retry.a[g_retry.n++] = (RetryEntry){ .e = e, .attempts = attempts };
+    wal_log(&g_wal, WAL_RETRY, attempts, e.expire, e.key, NULL, 0);
 }
 
-static void heap_free(MinHeap *h) {
-    for (size_t i=0;i<h->size;i++) free(h->a[i].path);
-    free(h->a);
-    h->a=NULL; h->size=h->cap=0;
+// ---- 만기 단위 삭제 ----
+// 월/일/시 노드는 만기가 된 이 시점에만 하위 단위(일/시/분)로 펼친다.
+// 분 디렉터리는 purge_dir_at으로 비우고, busy인 분 디렉터리만 분 단위 키로 재시도 큐에 넣는다.
+
+// 하위 단위 디렉터리 이름 -> 단위 시작(epoch 분). 형식이 아니면 false
+static bool child_minute(PkGran child, const char *name, uint32_t parent_min, uint32_t *out) {
+    int v;
+    if (strlen(name) != 2 || !dp_digits2(name, &v)) return false;
+    switch (child) {
+        case PK_DAY: {
+            time_t t = (time_t)parent_min * 60;
+            struct tm tmv;
+            gmtime_r(&t, &tmv);
+            if (v < 1 || v > dp_days_in_month(tmv.tm_year + 1900, tmv.tm_mon + 1)) return false;
+            *out = parent_min + (uint32_t)(v-1)*1440;
+            return true;
+        }
+        case PK_HOUR:   if (v > 23) return false;           *out = parent_min + (uint32_t)v*60;       return true;
+        case PK_MINUTE: if (v > 59) return false;           *out = parent_min + (uint32_t)v;          return true;
+        default:        return false;
+    }
 }
 
-// ---- 경로에서 시간 파싱: /root/company/device/YYYY/MM/DD/HH/mm ----
-// 성공 시 true, out_epoch에 time_t 저장 (로컬타임 가정; UTC 쓰려면 timegm)
-static bool parse_epoch_from_path(const char *path, time_t *out_epoch) {
-    // 끝에서 5개 디렉토리(YYYY/MM/DD/HH/mm)를 토큰으로 뽑음
-    // 안전한 복사본
-    char buf[PATH_MAX]; strncpy(buf, path, sizeof(buf)); buf[sizeof(buf)-1]=0;
-    // 토큰 수를 세기 위해 슬래시 기준 분해
-    // 간단화를 위해 strtok_r로 전체 토큰을 배열에 모은다
-    char *save=NULL, *tok=NULL;
-    char *parts[64]; int n=0;
-    for (tok=strtok_r(buf, "/", &save); tok && n<64; tok=strtok_r(NULL, "/", &save)) parts[n++]=tok;
-    if (n < 5) return false;
+// parent_fd 아래 name(= key 단위 디렉터리)을 삭제. busy로 남은 것이 있으면 true
+static bool expand_unit(int parent_fd, const char *name, uint64_t key,
+                        unsigned attempts, time_t now, PURGE_STAT *st) {
+    PkGran g = pk_gran(key);
+    bool busy = false;
 
-    int mm  = atoi(parts[n-1]);
-    int HH  = atoi(parts[n-2]);
-    int DD  = atoi(parts[n-3]);
-    int MON = atoi(parts[n-4]); // 1..12
-    int YYYY= atoi(parts[n-5]);
+    if (g != PK_MINUTE) {
+        int fd = openat(parent_fd, name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+        if (fd < 0) {
+            if (errno != ENOENT) perror(name);
+            return false;
+        }
+        // DIR 대신 스레드별 깊이당 버퍼로 읽는다 (정상 상태에서 할당 없음, dir_purge.h)
+        PURGE_DENTS dir;
+        if (!purge_dents_open(&dir, fd)) { perror(name); return false; }
 
-    struct tm tmv = {0};
-    tmv.tm_year = YYYY - 1900;
-    tmv.tm_mon  = MON - 1;
-    tmv.tm_mday = DD;
-    tmv.tm_hour = HH;
-    tmv.tm_min  = mm;
-    tmv.tm_sec  = 0;
+        PkGran child = (PkGran)(g - 1);
+        const char *cname;
+        unsigned char type;
+        uint32_t cmin;
+        while (purge_dents_next(&dir, &cname, &type)) {
+            if (type != DT_DIR && type != DT_UNKNOWN) continue;
+            if (!child_minute(child, cname, pk_minute(key), &cmin)) continue;
+            busy |= expand_unit(dir.fd, cname,
+                                pk_make(pk_dev(key), child, cmin), 0, now, st);
+        }
+        int err = dir.err;
+        purge_dents_close(&dir);
+        if (err) {          // 못 읽은 나머지를 busy로 재시도하지 않는다
+            errno = err;
+            perror(name);
+            st->errors++;
+            return busy;
+        }
 
-    time_t t = mktime(&tmv); // 로컬타임 기준. UTC를 쓰려면 timegm(&tmv)
-    if (t == (time_t)-1) return false;
-    *out_epoch = t;
-    return true;
-}
+        // 하위가 남아 있으면 자기 자신은 그대로 둔다 (재시도 성공 후 prune_parents가 정리)
+        if (busy || gDry_run) return busy;
+    }
 
-// ---- nftw 콜백에서 "분 디렉토리"만 힙에 등록 ----
-// level = .../YYYY/MM/DD/HH/mm  까지 내려왔을 때 FTW_D (pre) 또는 FTW_DP (post) 시점 중 선택.
-// 여기선 FTW_D(선주문)에서 등록만 하고, 실제 삭제는 워커 루프가 처리.
-static MinHeap g_heap;
+    // 분 디렉터리 / 펼친 뒤 남은 빈 시·일 디렉터리와 형식 밖의 잔여 항목 정리
+    // (펼친 디렉터리는 방금 하위를 지워 mtime이 갱신됐으므로 busy_grace 검사 제외)
+    PURGE_OPT opt = g_purge_opt;
+    if (g != PK_MINUTE) opt.busy_grace = 0;
+    switch (purge_dir_at(parent_fd, name, &opt, st)) {
+        case PURGE_BUSY:
+            retry_schedule((HeapEntry){ .key = key }, attempts+1, now);
+            return true;
+        case PURGE_DONE:
+        case PURGE_GONE:
+        case PURGE_ERROR:   // purge_dir_at에서 이미 perror
+            break;
+    }
+    return false;
+}
 
-static int cb_register_minute_dir(const char *fpath, const struct stat *sb, int typeflag, struct FTW *ftwbuf) {
-    (void)sb;
-    if (typeflag != FTW_D) return 0;   // 디렉토리만 고려
-    // 트리 깊이가 7(= data/company/device/YYYY/MM/DD/HH/mm)라는 가정이면 여기에서 필터링 가능
-    if (ftwbuf->level < 7) return 0;
+// 단위 삭제 후 비어 버린 상위(시/일/월/연) 디렉터리 제거. 비어있지 않으면 멈춤.
+static void prune_parents(uint64_t key) {
+    for (int g = (int)pk_gran(key) + 1; g <= PK_MONTH + 1; g++) {
+        char *p = pk_path(&g_keys, pk_make(pk_dev(key), g <= PK_MONTH ? (PkGran)g : PK_MONTH,
+                                                  pk_minute(key)));
+        if (g > PK_MONTH) {             // 연 디렉터리: 월 경로에서 "/MM" 제거
+            char *slash = strrchr(p, '/');
+            if (slash) *slash = '\0';
+        }
+        if (rmdir(p) != 0) break;
+    }
+}
 
-    time_t create_epoch;
-    if (!parse_epoch_from_path(fpath, &create_epoch)) return 0;
+// 삭제 1건: 단위 디렉터리의 부모를 열고, 그 fd 기준으로 펼쳐서 삭제. 지운 파일 수 반환
+static unsigned long delete_entry(HeapEntry e, unsigned attempts, time_t now) {
+    PURGE_STAT st = {0};
+    char *path = pk_path(&g_keys, e.key);   // 이 시점에만 경로 문자열 생성
+    char *slash = strrchr(path, '/');
+    char name[8];
+    if (!slash || strlen(slash+1) >= sizeof(name)) return 0;
+    strcpy(name, slash+1);
+    *slash = '\0';
 
-    time_t expire = create_epoch + gRetention_secs;
+    int pfd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (pfd < 0) {
+        if (errno != ENOENT) perror(path);
+        return 0;
+    }
+    bool busy = expand_unit(pfd, name, e.key, attempts, now, &st);
+    close(pfd);
 
-    // 엔트리 등록
-    HeapEntry e = { .expire = expire, .path = strdup(fpath) };
-    heap_push(&g_heap, e);
-    return 0;
+    if (gDry_run) {
+        printf("[DRY-RUN] Would delete: %s (expire=%ld, %lu files)\n",
+               pk_path(&g_keys, e.key), (long)e.expire, st.files);
+        return st.files;
+    }
+    printf("%s: %s (%lu files, %lu dirs)\n", busy ? "Partially deleted" : "Deleted",
+           pk_path(&g_keys, e.key), st.files, st.dirs);
+    if (!busy) prune_parents(e.key);
+    return st.files;
 }
 
 // ---- 삭제 워커 (힙 top 만기까지 반복) ----
+// --io-budget N: 초당 unlink 파일 수 상한 (token bucket, 최대 1초 분량 버스트).
+// 예산을 다 쓰면 남은 만기 엔트리는 힙에 그대로 두고 다음 주기에 이어서 처리한다.
+static long   g_io_budget = 0;      // 0 = 무제한
+static double g_io_tokens = 0;
+static time_t g_io_last = 0;
+
+static bool io_budget_left(time_t now) {
+    if (g_io_budget <= 0) return true;
+    g_io_tokens += (double)(now - g_io_last) * (double)g_io_budget;
+    if (g_io_tokens > (double)g_io_budget) g_io_tokens = (double)g_io_budget;
+    g_io_last = now;
+    return g_io_tokens > 0;
+}
+
 static void process_due_deletes(void) {
     time_t now = time(NULL);
     HeapEntry e;
-    while (heap_peek(&g_heap, &e) && e.expire <= now) {
+
+    // 재시도 큐: 만기된 것만 꺼내 처리 (swap-remove)
+    for (size_t i=0; i<g_retry.n && io_budget_left(now); ) {
+        if (g_retry.a[i].e.expire > now) { i++; continue; }
+        RetryEntry r = g_retry.a[i];
+        g_retry.a[i] = g_retry.a[--g_retry.n];
+        g_io_tokens -= (double)delete_entry(r.e, r.attempts, now);
+        wal_log(&g_wal, WAL_RETRY_DONE, r.attempts, r.e.expire, r.e.key, NULL, 0);
+    }
+
+    // WAL에는 지운 뒤에 남긴다 (커밋 전에 죽으면 다시 지우려다 PURGE_GONE으로 끝남)
+    while (io_budget_left(now) && heap_peek(&g_heap, &e) && e.expire <= now) {
         heap_pop(&g_heap, &e); // 꺼낸다
-        if (gDry_run) {
-            printf("[DRY-RUN] Would delete: %s (expire=%ld)\n", e.path, (long)e.expire);
-        } else {
-            if (remove(e.path) == 0) {
-                // 디렉토리가 비어있을 때만 성공; 비어있지 않으면 ENOTEMPTY.
-                printf("Deleted: %s\n", e.path);
-            } else if (errno == ENOTEMPTY) {
-                // 아직 하위 파일이 남아있음 → 다음 주기에 재시도(혹은 하위부터 파일 먼저 지우기)
-                // 간단히: 재등록(약간 뒤로 미룸)
-                e.expire = now + 60;  // 1분 후 재시도 (전략은 상황에 맞춰 조정)
-                heap_push(&g_heap, e);
-                continue; // free(e.path) 금지: 재사용
-            } else {
-                perror(e.path);
-            }
+        g_io_tokens -= (double)delete_entry(e, 0, now);
+        wal_log(&g_wal, WAL_POP, 0, e.expire, e.key, NULL, 0);
+        now = time(NULL);
+    }
+    wal_commit(&g_wal);     // 주기마다 fdatasync 한 번 (group commit)
+}
+
+// ---- 상태 복구 / 스냅샷 (--state) ----
+static uint32_t g_state_roots;  // 스냅샷의 루트 수 (-r 목록과 같아야 함)
+
+static bool state_apply(void *arg, const WalRec *r, const char *name) {
+    (void)arg;
+    HeapEntry e = { .expire = (time_t)r->expire, .key = r->key };
+    switch ((WalType)r->type) {
+        case WAL_ROOT:      // 같은 루트가 같은 순서로 주어져야 키의 루트 id가 맞는다
+            if (r->aux != g_state_roots || r->aux >= g_keys.nroot ||
+                strlen(g_keys.root[r->aux]) != r->len || memcmp(g_keys.root[r->aux], name, r->len) != 0)
+                return false;
+            g_state_roots++;
+            return true;
+        case WAL_DEV: {
+            const char *slash = memchr(name, '/', r->len);
+            if (!slash) return false;
+            return pk_intern(&g_keys, r->aux, name, (size_t)(slash - name),
+                             slash + 1, r->len - (size_t)(slash - name) - 1) == (int64_t)r->key;
         }
-        free(e.path);
+        case WAL_PUSH:
+            return pk_dev(e.key) < g_keys.ndev && heap_push(&g_heap, e);
+        case WAL_POP: {     // (expire, key) 전순서라 pop 순서는 배열 모양과 무관하게 같다
+            HeapEntry top;
+            return heap_pop(&g_heap, &top) && top.expire == e.expire && top.key == e.key;
+        }
+        case WAL_RETRY:
+            if (g_retry.n > RETRY_QUEUE_MAX || pk_dev(e.key) >= g_keys.ndev) return false;
+            g_retry.a[g_retry.n++] = (RetryEntry){ .e = e, .attempts = r->aux };
+            return true;
+        case WAL_RETRY_DONE:
+            for (size_t i=0; i<g_retry.n; i++) {
+                if (g_retry.a[i].e.key == e.key && g_retry.a[i].attempts == r->aux) {
+                    g_retry.a[i] = g_retry.a[--g_retry.n];
+                    return true;
+                }
+            }
+            return false;
     }
+    return false;
+}
+
+// 복구 실패: 반쯤 채운 힙/재시도 큐/인턴 테이블을 비우고 스캔으로 다시 만든다
+static bool state_discard(bool heap_release) {
+    heap_free(&g_heap);
+    heap_init(&g_heap);
+    heap_set_release(&g_heap, heap_release);
+    g_retry.n = 0;
+    g_state_roots = 0;
+    pk_free(&g_keys);
+    pk_init(&g_keys);
+    for (uint32_t i=0; i<g_nroots; i++)
+        if (pk_add_root(&g_keys, g_roots[i].path) != (int64_t)i) return false;
+    return true;
+}
+
+// 설정이 바뀌면 저장된 만기 시각이 틀리므로 식별값에 config 파일의 mtime/크기를 쓴다
+static uint64_t config_ident(const char *path) {
+    struct stat st;
+    if (stat(path, &st) != 0) return 0;
+    return (uint64_t)st.st_mtim.tv_sec * 1000000007u ^ (uint64_t)st.st_mtim.tv_nsec ^
+           (uint64_t)st.st_size << 40;
+}
+
+// 기준 스냅샷: 스캔 결과(루트, device 이름, 재시도 큐, 힙)를 삭제 시작 전에 통째로 기록.
+// 이후 스냅샷은 heap_wal.c가 이것과 WAL로 만든다 (device는 스캔 때만 인턴되므로 WAL에 없다)
+static bool write_base_snapshot(void) {
+    for (uint32_t i=0; i<g_keys.nroot; i++)
+        wal_base_rec(&g_wal, WAL_ROOT, i, 0, 0, g_keys.root[i], strlen(g_keys.root[i]));
+    char name[PATH_MAX];
+    for (uint32_t i=0; i<g_keys.ndev; i++) {
+        const PkDevice *d = &g_keys.dev[i];
+        int n = snprintf(name, sizeof(name), "%s/%s", g_keys.company[d->company], d->name);
+        wal_base_rec(&g_wal, WAL_DEV, d->root, 0, i, name, (size_t)n);
+    }
+    for (size_t i=0; i<g_retry.n; i++)
+        wal_base_rec(&g_wal, WAL_RETRY, g_retry.a[i].attempts,
+                     g_retry.a[i].e.expire, g_retry.a[i].e.key, NULL, 0);
+    return wal_base_end(&g_wal, &g_heap);
+}
+
+#ifdef _DEBUG_
+// ---- 정상 상태 할당 검사 ----
+// malloc 계열을 가로채(glibc __libc_*) 호출 횟수를 센다. 삭제 주기는 힙 pop,
+// 재시도 큐, 경로 버퍼(pk_path), 디렉터리 버퍼(dir_purge) 모두 미리 잡아 둔
+// 메모리만 쓰므로 첫 주기 이후 한 번이라도 할당하면 abort 한다.
+extern void *__libc_malloc(size_t);
+extern void *__libc_calloc(size_t, size_t);
+extern void *__libc_realloc(void *, size_t);
+extern void *__libc_memalign(size_t, size_t);
+static unsigned long g_alloc_calls;
+
+void *malloc(size_t n) { __atomic_fetch_add(&g_alloc_calls, 1, __ATOMIC_RELAXED); return __libc_malloc(n); }
+void *calloc(size_t n, size_t m) { __atomic_fetch_add(&g_alloc_calls, 1, __ATOMIC_RELAXED); return __libc_calloc(n, m); }
+void *realloc(void *p, size_t n) { __atomic_fetch_add(&g_alloc_calls, 1, __ATOMIC_RELAXED); return __libc_realloc(p, n); }
+int posix_memalign(void **p, size_t align, size_t n) {
+    __atomic_fetch_add(&g_alloc_calls, 1, __ATOMIC_RELAXED);
+    *p = __libc_memalign(align, n);
+    return *p ? 0 : ENOMEM;
+}
+
+static void process_due_deletes(void);
+
+// 첫 주기(stdio 버퍼 등 지연 할당)는 제외하고, 이후 주기마다 할당 0회를 확인
+static void process_due_deletes_checked(void) {
+    static unsigned long cycles;
+    unsigned long before = __atomic_load_n(&g_alloc_calls, __ATOMIC_RELAXED);
+    process_due_deletes();
+    unsigned long n = __atomic_load_n(&g_alloc_calls, __ATOMIC_RELAXED) - before;
+    if (cycles++ > 0 && n != 0) {
+        fprintf(stderr, "steady-state cycle %lu made %lu allocations\n", cycles, n);
+        abort();
+    }
+}
+#endif
+
+static void print_usage(const char *prog) {
+    fprintf(stderr,
+        "Usage: %s -c config.json [-r ROOT]... [--dry-run] [--fd N] [--io-budget N] [--heap-release]\n"
+        "          [--state DIR]\n"
+        "  -c/--config  config.json path (required)\n"
+        "  -r/--root    root directory to scan, repeatable, any depth (default /data)\n"
+        "  --dry-run    perform dry-run (default: false)\n"
+        "  --fd N       nftw max open fds (default 32)\n"
+        "  --io-budget N  max files unlinked per second (default 0: unlimited)\n"
+        "  --heap-release return heap pages to the OS when it shrinks below 1/4 of its peak\n"
+        "  --state DIR    keep a snapshot + WAL of the schedule in DIR and restart from it\n"
+        "                 instead of rescanning (read-only with --dry-run)\n", prog);
 }
 
 // ---- 초기 스캔 + 주기 처리의 예시 main 루프 ----
 int main(int argc, char **argv) {
-    // TODO: getopt_long로 g_root_path, gRetention_secs, gDry_run 등 세팅
-    //       config.json(cJSON) 로딩 → 회사/디바이스별 retention이면 map으로 보관 후 콜백에서 조회
+    enum { O_DRYRUN=1, O_FD, O_IO_BUDGET, O_HEAP_RELEASE, O_STATE };
+    static struct option longoptions[] = {
+        { "config",   required_argument, NULL, 'c'},
+        { "root",     required_argument, NULL, 'r'},
+        { "dry-run",  no_argument,       NULL, O_DRYRUN},
+        { "fd",       required_argument, NULL, O_FD    },
+        { "io-budget", required_argument, NULL, O_IO_BUDGET },
+        { "heap-release", no_argument,   NULL, O_HEAP_RELEASE },
+        { "state",    required_argument, NULL, O_STATE },
+        { NULL, 0, NULL, 0 }
+    };
+    const char *config_path = NULL;
+    const char *state_dir = NULL;
+    int fd_value = 32;
+    bool heap_release = false;
+    int c;
+
+    while ((c = getopt_long(argc, argv, "c:r:", longoptions, NULL)) != -1) {
+        switch (c) {
+            case 'c':      config_path = optarg;       break;
+            case 'r':
+                if (g_nroots == MAX_ROOTS) { fprintf(stderr, "too many roots\n"); return EXIT_FAILURE; }
+                g_roots[g_nroots++] = ps_root(optarg);
+                break;
+            case O_DRYRUN: gDry_run = true;            break;
+            case O_FD:     fd_value = atoi(optarg);    break;
+            case O_IO_BUDGET: g_io_budget = atol(optarg); break;
+            case O_HEAP_RELEASE: heap_release = true; break;
+            case O_STATE:  state_dir = optarg;         break;
+            default:       print_usage(argv[0]);       return EXIT_FAILURE;
+        }
+    }
+    if (!config_path) { print_usage(argv[0]); return EXIT_FAILURE; }
+    // rm_retention --compile-config 로 만든 캐시가 최신이면 그대로 매핑, 아니면 JSON 파싱
+    if (!retn_load_config(config_path, &g_cfg)) return EXIT_FAILURE;
+    printf("Config: %u companies, %s in %.3f ms, %zu bytes\n",
+           g_cfg.count, g_cfg.map ? "mapped from cache" : "parsed",
+           g_cfg.parse_ms, retn_config_mem(&g_cfg));
+
+    if (g_nroots == 0) g_roots[g_nroots++] = ps_root("/data");
 
     heap_init(&g_heap);
+    heap_set_release(&g_heap, heap_release);
+    pk_init(&g_keys);
+    for (uint32_t i=0; i<g_nroots; i++) {
+        if (pk_add_root(&g_keys, g_roots[i].path) != (int64_t)i) { perror("pk_add_root"); return EXIT_FAILURE; }
+    }
+    // 정상 상태 주기에서 쓰는 메모리는 여기서 미리 잡는다
+    g_retry.a = (RetryEntry*)malloc((RETRY_QUEUE_MAX + 1) * sizeof(RetryEntry));
+    if (!g_retry.a || !purge_reserve_scratch()) { perror("malloc"); return EXIT_FAILURE; }
+    g_purge_opt = g_purge_opt_default;
+    g_purge_opt.dry_run = gDry_run;
+    g_io_last = time(NULL);
+    g_io_tokens = (double)g_io_budget;
+
+    // 0) --state: 스냅샷 + WAL이 있으면 스캔 없이 힙/재시도 큐를 되살린다
+    bool recovered = false;
+    if (state_dir) {
+        wal_init(&g_wal, state_dir, config_ident(config_path));
+        if (wal_recover(&g_wal, state_apply, NULL)) {
+            recovered = (g_state_roots == g_nroots);
+            if (!recovered) printf("State: roots changed since the snapshot, scanning\n");
+        }
+        if (!recovered) {
+            if (!state_discard(heap_release)) { perror("pk_add_root"); return EXIT_FAILURE; }
+            if (!gDry_run) wal_reset(&g_wal);
+        }
+    }
+
+    // 1) 초기 스캔: 루트마다 모든 만기 단위 디렉터리를 힙에 등록 (그 아래는 읽지 않음)
+    //    힙은 하나이므로 여러 볼륨의 만기가 한 순서로 섞여 처리된다.
+    for (g_cur_root = 0; !recovered && g_cur_root < g_nroots; g_cur_root++) {
+        if (nftw(g_roots[g_cur_root].path, cb_register_unit_dir, fd_value,
+                 FTW_PHYS | FTW_ACTIONRETVAL) != 0) {
+            perror(g_roots[g_cur_root].path);
+            // 한 볼륨이 실패해도 나머지는 계속 스캔
+        }
+    }
+    if (g_malformed)
+        printf("Skipped %lu malformed date directories\n", g_malformed);
 
-    // 1) 초기 스캔: 모든 "분" 디렉터리를 힙에 등록
-    if (nftw(g_root_path, cb_register_minute_dir, 32, FTW_PHYS | FTW_ACTIONRETVAL) != 0) {
-        perror("nftw");
-        // 계속 진행할지 종료할지 결정
+    // 스캔/복구가 끝난 뒤부터 기록. 스캔했으면 삭제 전에 기준 스냅샷부터 (없으면 WAL은 쓸모없다)
+    if (state_dir && !gDry_run) {
+        if (!wal_start(&g_wal)) return EXIT_FAILURE;
+        if (!recovered && !write_base_snapshot()) return EXIT_FAILURE;
     }
 
     // 2) 메인 워커 루프 (데몬이라면 sleep 간격 조절)
     for (;;) {
+#ifdef _DEBUG_
+        process_due_deletes_checked();
+#else
         process_due_deletes();
+#endif
+        if (wal_snapshot_due(&g_wal, time(NULL))) wal_compact(&g_wal);
         // 새 디렉터리 반영: inotify가 없다면 주기적으로 신규 스캔 추가
         // 예: 5분마다 가벼운 재스캔을 하여 미등록 항목을 보강
         sleep(5);
     }
 
+    if (state_dir) wal_stop(&g_wal);
+    free(g_retry.a);
     heap_free(&g_heap);
+    pk_free(&g_keys);
+    retn_config_free(&g_cfg);
     return 0;
 }
 
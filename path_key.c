@@ -0,0 +1,176 @@
+#define _GNU_SOURCE
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "path_key.h"
+
+static __thread char tl_path[PATH_MAX];
+
+static uint32_t fnv1a(uint32_t h, const char *s, size_t n) {
+    for (size_t i=0; i<n; i++) { h ^= (unsigned char)s[i]; h *= 16777619u; }
+    return h;
+}
+
+static char *dup_n(const char *s, size_t n) {
+    char *p = (char*)malloc(n+1);
+    if (p) { memcpy(p, s, n); p[n] = 0; }
+    return p;
+}
+
+// 슬롯 배열을 2배로 늘리고 다시 채운다 (load factor <= 1/2 유지)
+static bool rehash(uint32_t **slot, uint32_t *nslot, uint32_t count,
+                   uint32_t (*hash_of)(const PathIntern*, uint32_t), const PathIntern *pi) {
+    uint32_t n = *nslot ? *nslot*2 : 1024;
+    uint32_t *ns = (uint32_t*)calloc(n, sizeof(uint32_t));
+    if (!ns) return false;
+    for (uint32_t id=0; id<count; id++) {
+        uint32_t i = hash_of(pi, id) & (n-1);
+        while (ns[i]) i = (i+1) & (n-1);
+        ns[i] = id+1;
+    }
+    free(*slot);
+    *slot = ns; *nslot = n;
+    return true;
+}
+
+static uint32_t company_hash(const PathIntern *pi, uint32_t id) {
+    const char *s = pi->company[id];
+    return fnv1a(2166136261u, s, strlen(s));
+}
+
+// device 해시 테이블의 키: (루트, company) 를 섞은 시드 + device 이름
+static uint32_t dev_seed(uint32_t root, uint32_t company) {
+    return company * 2654435761u ^ root * 0x85EBCA6Bu;
+}
+
+static uint32_t dev_hash(const PathIntern *pi, uint32_t id) {
+    const char *s = pi->dev[id].name;
+    return fnv1a(dev_seed(pi->dev[id].root, pi->dev[id].company), s, strlen(s));
+}
+
+void pk_init(PathIntern *pi) {
+    memset(pi, 0, sizeof(*pi));
+}
+
+int64_t pk_add_root(PathIntern *pi, const char *root) {
+    size_t n = strlen(root);
+    while (n > 1 && root[n-1] == '/') n--;
+    if (pi->nroot == pi->root_cap) {
+        uint32_t ncap = pi->root_cap ? pi->root_cap*2 : 8;
+        char **na = (char**)realloc(pi->root, ncap*sizeof(char*));
+        if (!na) return -1;
+        pi->root = na; pi->root_cap = ncap;
+    }
+    char *r = dup_n(root, n);
+    if (!r) return -1;
+    pi->root[pi->nroot] = r;
+    return pi->nroot++;
+}
+
+void pk_free(PathIntern *pi) {
+    for (uint32_t i=0; i<pi->nroot; i++) free(pi->root[i]);
+    for (uint32_t i=0; i<pi->ncompany; i++) free(pi->company[i]);
+    for (uint32_t i=0; i<pi->ndev; i++) free(pi->dev[i].name);
+    free(pi->company); free(pi->dev);
+    free(pi->company_slot); free(pi->dev_slot);
+    free(pi->root);
+    memset(pi, 0, sizeof(*pi));
+}
+
+static int64_t intern_company(PathIntern *pi, const char *s, size_t n) {
+    uint32_t h = fnv1a(2166136261u, s, n);
+    if (pi->company_nslot) {
+        for (uint32_t i = h & (pi->company_nslot-1); pi->company_slot[i]; i = (i+1) & (pi->company_nslot-1)) {
+            const char *c = pi->company[pi->company_slot[i]-1];
+            if (strncmp(c, s, n) == 0 && c[n] == 0) return pi->company_slot[i]-1;
+        }
+    }
+
+    if (2*(pi->ncompany+1) > pi->company_nslot &&
+        !rehash(&pi->company_slot, &pi->company_nslot, pi->ncompany, company_hash, pi))
+        return -1;
+    if (pi->ncompany == pi->company_cap) {
+        uint32_t ncap = pi->company_cap ? pi->company_cap*2 : 64;
+        char **na = (char**)realloc(pi->company, ncap*sizeof(char*));
+        if (!na) return -1;
+        pi->company = na; pi->company_cap = ncap;
+    }
+    char *name = dup_n(s, n);
+    if (!name) return -1;
+
+    uint32_t id = pi->ncompany++;
+    pi->company[id] = name;
+    uint32_t i = h & (pi->company_nslot-1);
+    while (pi->company_slot[i]) i = (i+1) & (pi->company_nslot-1);
+    pi->company_slot[i] = id+1;
+    return id;
+}
+
+int64_t pk_intern(PathIntern *pi, uint32_t root, const char *company, size_t company_len,
+                  const char *device, size_t device_len) {
+    if (root >= pi->nroot) return -1;
+    int64_t cid = intern_company(pi, company, company_len);
+    if (cid < 0) return -1;
+
+    uint32_t h = fnv1a(dev_seed(root, (uint32_t)cid), device, device_len);
+    if (pi->dev_nslot) {
+        for (uint32_t i = h & (pi->dev_nslot-1); pi->dev_slot[i]; i = (i+1) & (pi->dev_nslot-1)) {
+            const PkDevice *d = &pi->dev[pi->dev_slot[i]-1];
+            if (d->company == (uint32_t)cid && d->root == root &&
+                strncmp(d->name, device, device_len) == 0 &&
+                d->name[device_len] == 0)
+                return pi->dev_slot[i]-1;
+        }
+    }
+
+    if (pi->ndev == UINT32_MAX) return -1;
+    if (2*(pi->ndev+1) > pi->dev_nslot &&
+        !rehash(&pi->dev_slot, &pi->dev_nslot, pi->ndev, dev_hash, pi))
+        return -1;
+    if (pi->ndev == pi->dev_cap) {
+        uint32_t ncap = pi->dev_cap ? pi->dev_cap*2 : 256;
+        PkDevice *na = (PkDevice*)realloc(pi->dev, ncap*sizeof(PkDevice));
+        if (!na) return -1;
+        pi->dev = na; pi->dev_cap = ncap;
+    }
+    char *name = dup_n(device, device_len);
+    if (!name) return -1;
+
+    // intern 순서와 무관한 안정적인 해시 (만기 분산용)
+    const char *r = pi->root[root];
+    uint32_t nh = fnv1a(fnv1a(2166136261u, r, strlen(r)), "/", 1);
+    nh = fnv1a(fnv1a(nh, company, company_len), "/", 1);
+    nh = fnv1a(nh, device, device_len);
+
+    uint32_t id = pi->ndev++;
+    pi->dev[id] = (PkDevice){ .company = (uint32_t)cid, .root = root, .hash = nh, .name = name };
+    uint32_t i = h & (pi->dev_nslot-1);
+    while (pi->dev_slot[i]) i = (i+1) & (pi->dev_nslot-1);
+    pi->dev_slot[i] = id+1;
+    return id;
+}
+
+const char *pk_company(const PathIntern *pi, uint64_t key) {
+    return pi->company[pi->dev[pk_dev(key)].company];
+}
+
+char *pk_path(const PathIntern *pi, uint64_t key) {
+    const PkDevice *d = &pi->dev[pk_dev(key)];
+    time_t t = (time_t)pk_minute(key) * 60;
+    struct tm tmv;
+    gmtime_r(&t, &tmv);
+    int n = snprintf(tl_path, sizeof(tl_path), "%s/%s/%s/%04d/%02d",
+                     pi->root[d->root], pi->company[d->company], d->name,
+                     tmv.tm_year + 1900, tmv.tm_mon + 1);
+    PkGran g = pk_gran(key);
+    if (g <= PK_DAY  && n > 0 && (size_t)n < sizeof(tl_path))
+        n += snprintf(tl_path+n, sizeof(tl_path)-n, "/%02d", tmv.tm_mday);
+    if (g <= PK_HOUR && n > 0 && (size_t)n < sizeof(tl_path))
+        n += snprintf(tl_path+n, sizeof(tl_path)-n, "/%02d", tmv.tm_hour);
+    if (g <= PK_MINUTE && n > 0 && (size_t)n < sizeof(tl_path))
+        snprintf(tl_path+n, sizeof(tl_path)-n, "/%02d", tmv.tm_min);
+    return tl_path;
+}
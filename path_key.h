@@ -0,0 +1,70 @@
+#ifndef __PATH_KEY_H__
+#define __PATH_KEY_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// ---- 경로 압축 키 ----
+// 모든 경로는 <root>/<company>/<device>/YYYY/MM/DD/HH/mm 형태이므로
+// 문자열 대신 64bit 키로 저장한다. 루트(볼륨)는 여러 개일 수 있고 깊이도 자유롭다.
+//   [63..32] device id  [31..30] 단위(월/일/시/분)  [29..0] 단위 시작의 UTC epoch 분
+//   (30bit 분 = 약 2000년 범위)
+//  - company/device 이름은 한 번만 인턴 (device id -> 루트 id, company id -> 이름)
+//    같은 company/device 이름이라도 루트가 다르면 다른 device id
+//  - 경로 문자열은 삭제 시점에만 thread-local 버퍼에 snprintf로 만든다
+// HeapEntry = expire(8B) + key(8B) = 16B -> 1억 개 스케줄이 약 1.6GB.
+
+typedef struct {
+    uint32_t company;   // company 테이블 인덱스
+    uint32_t root;      // 루트 테이블 인덱스
+    uint32_t hash;      // "root/company/device" 이름 해시 (재시작해도 같은 값)
+    char    *name;
+} PkDevice;
+
+typedef struct {
+    char     **root;          // 루트 id -> 끝의 '/' 제거된 경로
+    uint32_t   nroot, root_cap;
+
+    char     **company;       // company id -> 이름
+    uint32_t   ncompany, company_cap;
+    PkDevice  *dev;           // device id -> (company, 이름)
+    uint32_t   ndev, dev_cap;
+
+    // 인턴용 open addressing 해시 (값 = id+1, 0 = 빈 칸)
+    uint32_t  *company_slot;  uint32_t company_nslot;
+    uint32_t  *dev_slot;      uint32_t dev_nslot;
+} PathIntern;
+
+// 키가 가리키는 디렉터리 단위 (값 = 분 디렉터리에서 위로 올라간 단계 수)
+typedef enum { PK_MINUTE = 0, PK_HOUR, PK_DAY, PK_MONTH } PkGran;
+
+#define PK_MINUTE_BITS  30
+#define PK_MINUTE_MAX   ((1u << PK_MINUTE_BITS) - 1)
+
+static inline uint64_t pk_make(uint32_t dev, PkGran g, uint32_t minute) {
+    return ((uint64_t)dev << 32) | ((uint64_t)g << PK_MINUTE_BITS) | (minute & PK_MINUTE_MAX);
+}
+static inline uint32_t pk_dev(uint64_t key)    { return (uint32_t)(key >> 32); }
+static inline PkGran   pk_gran(uint64_t key)   { return (PkGran)((key >> PK_MINUTE_BITS) & 3); }
+static inline uint32_t pk_minute(uint64_t key) { return (uint32_t)key & PK_MINUTE_MAX; }
+
+void pk_init(PathIntern *pi);
+void pk_free(PathIntern *pi);
+
+// 스캔할 루트 등록. 루트 id 반환, 실패 시 -1
+int64_t pk_add_root(PathIntern *pi, const char *root);
+
+// (루트, company, device) 를 device id로 인턴. 실패 시 -1
+int64_t pk_intern(PathIntern *pi, uint32_t root, const char *company, size_t company_len,
+                  const char *device, size_t device_len);
+
+// 키 -> 절대경로, 단위 깊이까지만 (thread-local 버퍼; 다음 호출 전까지만 유효, 잘라 써도 됨)
+char *pk_path(const PathIntern *pi, uint64_t key);
+const char *pk_company(const PathIntern *pi, uint64_t key);
+
+static inline uint32_t pk_dev_hash(const PathIntern *pi, uint64_t key) {
+    return pi->dev[pk_dev(key)].hash;
+}
+
+#endif //__PATH_KEY_H__
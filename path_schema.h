@@ -0,0 +1,73 @@
+#ifndef __PATH_SCHEMA_H__
+#define __PATH_SCHEMA_H__
+
+#include <stddef.h>
+#include <string.h>
+
+// Directory layout below every root, anchored at the root itself:
+//   <root>/<company>/<device>/YYYY/MM/DD/HH/mm
+// The levels are nftw levels (root = 0), so they hold for a root at any
+// depth (/data, /mnt/vol17/tenantdata, ...). Walkers compare against these
+// instead of counting path components from "/".
+
+typedef enum {
+  PS_ROOT = 0, PS_COMPANY, PS_DEVICE,
+  PS_YEAR, PS_MONTH, PS_DAY, PS_HOUR, PS_MINUTE,
+  PS_NLEVEL
+} PS_LEVEL;
+
+// level of the directory that is one expiry unit (RETN_GRAN / PkGran:
+// 0=minute .. 3=month)
+static inline int ps_unit_level(int gran)
+{
+  return PS_MINUTE - gran;
+}
+
+// date component (DP_YEAR .. DP_MINUTE in date_parse.h) named by a date level
+static inline int ps_date_comp(int level)
+{
+  return level - PS_YEAR;
+}
+
+// A root as given on the command line, measured once at startup.
+typedef struct tagPS_ROOTDIR {
+  const char *path;
+  size_t len;     // without trailing '/'
+  size_t off;     // where the first component below the root starts in
+                  // walker paths (nftw keeps the root string verbatim)
+} PS_ROOTDIR;
+
+static inline PS_ROOTDIR ps_root(const char *path)
+{
+  PS_ROOTDIR r = { path, strlen(path), strlen(path) };
+  while (r.len > 1 && path[r.len - 1] == '/')
+    r.len--;
+  return r;
+}
+
+// Split the part of a walker path below the root into (ptr, len) spans, one
+// per level starting at PS_COMPANY, without copying. Empty components ("//")
+// are skipped. Returns the number of spans, or -1 if the path is deeper than
+// a minute directory.
+static inline int ps_split(const PS_ROOTDIR *root, const char *path, size_t len,
+    const char *comp[PS_NLEVEL - 1], size_t comp_len[PS_NLEVEL - 1])
+{
+  const char *p = path + (len > root->off ? root->off : len), *end = path + len;
+  int n = 0;
+
+  while (p < end) {
+    const char *slash = (const char *)memchr(p, '/', (size_t)(end - p));
+    const char *e = slash ? slash : end;
+    if (e > p) {
+      if (n == PS_NLEVEL - 1)
+        return -1;
+      comp[n] = p;
+      comp_len[n] = (size_t)(e - p);
+      n++;
+    }
+    p = e + 1;
+  }
+  return n;
+}
+
+#endif //__PATH_SCHEMA_H__
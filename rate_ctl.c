@@ -0,0 +1,127 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "rate_ctl.h"
+
+void rc_init(RATE_CTL *rc, unsigned id, double target_ms, long rate_max, int max_active)
+{
+  memset(rc, 0, sizeof(*rc));
+  pthread_mutex_init(&rc->lock, NULL);
+  rc->id = id;
+  rc->max_active = rc->active = (max_active > 0) ? max_active : 1;
+  if (target_ms <= 0)
+    return;
+
+  rc->target_ns = (unsigned long)(target_ms * 1e6);
+  rc->rate_max = rate_max;
+  rc->rate = (rate_max > 0 && rate_max < RC_RATE_START) ? rate_max : RC_RATE_START;
+  clock_gettime(CLOCK_MONOTONIC, &rc->window);
+}
+
+
+void rc_free(RATE_CTL *rc)
+{
+  pthread_mutex_destroy(&rc->lock);
+}
+
+
+// values below 2^RC_SUB_BITS get a bucket each; above, every power of two
+// is split into 2^RC_SUB_BITS linear steps
+static unsigned bucket_of(unsigned long v)
+{
+  if (v < (1UL << RC_SUB_BITS))
+    return (unsigned)v;
+  unsigned msb = 63u - (unsigned)__builtin_clzl(v);
+  unsigned sub = (unsigned)(v >> (msb - RC_SUB_BITS)) & ((1u << RC_SUB_BITS) - 1);
+  return ((msb - RC_SUB_BITS + 1) << RC_SUB_BITS) + sub;
+}
+
+// upper end of a bucket
+static unsigned long bucket_max(unsigned b)
+{
+  if (b < (1u << RC_SUB_BITS))
+    return b;
+  unsigned msb = (b >> RC_SUB_BITS) + RC_SUB_BITS - 1;
+  unsigned long sub = b & ((1u << RC_SUB_BITS) - 1);
+  return (((1UL << RC_SUB_BITS) + sub + 1) << (msb - RC_SUB_BITS)) - 1;
+}
+
+
+void rc_sample(void *arg, unsigned long ns)
+{
+  RATE_CTL *rc = (RATE_CTL *)arg;
+  __atomic_fetch_add(&rc->hist[bucket_of(ns)], 1, __ATOMIC_RELAXED);
+}
+
+
+int rc_active(const RATE_CTL *rc)
+{
+  return __atomic_load_n(&rc->active, __ATOMIC_RELAXED);
+}
+
+
+bool rc_tick(RATE_CTL *rc, long *rate)
+{
+  if (rc->target_ns == 0 || pthread_mutex_trylock(&rc->lock) != 0)
+    return false;
+
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  long ms = (now.tv_sec - rc->window.tv_sec) * 1000 + (now.tv_nsec - rc->window.tv_nsec) / 1000000;
+  unsigned long n = 0;
+  if (ms >= RC_WINDOW_MS)
+    for (unsigned b = 0; b < RC_NBUCKET; b++)
+      n += __atomic_load_n(&rc->hist[b], __ATOMIC_RELAXED);
+  if (n < RC_MIN_SAMPLES) {
+    pthread_mutex_unlock(&rc->lock);
+    return false;
+  }
+
+  // take the window and start the next; samples landing meanwhile go to either
+  unsigned long rank = n - n / 100, seen = 0, p99 = 0;
+  bool found = false;
+  for (unsigned b = 0; b < RC_NBUCKET; b++) {
+    seen += __atomic_exchange_n(&rc->hist[b], 0, __ATOMIC_RELAXED);
+    if (!found && seen >= rank) {
+      p99 = bucket_max(b);
+      found = true;
+    }
+  }
+  rc->window = now;
+  rc->p99_ns = p99;
+
+  long old_rate = rc->rate;
+  int old_active = rc->active;
+  int active = old_active;
+  bool over = (p99 > rc->target_ns);
+  if (over) {
+    rc->rate = (long)((double)rc->rate * RC_DECREASE);
+    if (rc->rate < RC_RATE_MIN)
+      rc->rate = RC_RATE_MIN;
+    active = (int)((double)active * RC_DECREASE);
+    if (active < 1)
+      active = 1;
+  }
+  else {
+    rc->rate += RC_RATE_STEP;
+    if (rc->rate_max > 0 && rc->rate > rc->rate_max)
+      rc->rate = rc->rate_max;
+    if (active < rc->max_active)
+      active++;
+  }
+  __atomic_store_n(&rc->active, active, __ATOMIC_RELAXED);
+
+  bool changed = (rc->rate != old_rate);
+  if (changed || active != old_active) {
+    if (over)
+      rc->downs++;
+    else
+      rc->ups++;
+    printf("Latency control %u: unlink p99 %.3f ms %s %.3f ms target: %ld -> %ld files/s, "
+        "%d -> %d deleters\n", rc->id, (double)p99 / 1e6, over ? ">" : "<=",
+        (double)rc->target_ns / 1e6, old_rate, rc->rate, old_active, active);
+  }
+  *rate = rc->rate;
+  pthread_mutex_unlock(&rc->lock);
+  return changed;
+}
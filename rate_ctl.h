@@ -0,0 +1,51 @@
+#ifndef __RATE_CTL_H__
+#define __RATE_CTL_H__
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <time.h>
+
+// Deletion rate controller (--latency-target MS), one per filesystem.
+// Every unlink is timed into a log-linear histogram. Once a window has
+// enough samples, its p99 is compared with the target: at or below it, the
+// unlink rate grows by a fixed step and one more deleter may run (additive
+// increase); above it, both are halved (multiplicative decrease). The rate
+// is applied through the filesystem's token bucket (vp_io_set_budget).
+
+#define RC_WINDOW_MS     1000
+#define RC_MIN_SAMPLES   64     // a window is extended until it has these
+#define RC_RATE_START    1000   // files/s
+#define RC_RATE_STEP     250
+#define RC_RATE_MIN      50
+#define RC_DECREASE      0.5
+#define RC_PARK_US       50000  // a deleter above the allowed count rechecks this often
+
+#define RC_SUB_BITS      3      // 8 linear steps per power of two: within 12.5%
+#define RC_NBUCKET       ((64 - RC_SUB_BITS + 1) << RC_SUB_BITS)
+
+typedef struct tagRATE_CTL {
+  unsigned id;                  // filesystem, for the log
+  unsigned long target_ns;      // 0: off
+  long rate, rate_max;          // files/s; rate_max 0: no ceiling
+  int active, max_active;       // deleters allowed to run (atomic)
+  unsigned long hist[RC_NBUCKET];   // this window (atomic adds)
+  struct timespec window;       // start of this window
+  unsigned long p99_ns;         // of the last closed window
+  unsigned long ups, downs;
+  pthread_mutex_t lock;
+} RATE_CTL;
+
+// target_ms <= 0: off, rc_tick() never changes anything
+void rc_init(RATE_CTL *rc, unsigned id, double target_ms, long rate_max, int max_active);
+void rc_free(RATE_CTL *rc);
+
+// PURGE_OPT latency hook: arg is the RATE_CTL
+void rc_sample(void *arg, unsigned long ns);
+
+// close the window if it is due; true when the rate changed (new one in *rate)
+bool rc_tick(RATE_CTL *rc, long *rate);
+
+// how many deleters may run now
+int rc_active(const RATE_CTL *rc);
+
+#endif //__RATE_CTL_H__
@@ -0,0 +1,1117 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "retn_config.h"
+
+static const char *gran_names[] = { "minute", "hour", "day", "month" };
+
+const char *retn_gran_name(RETN_GRAN g)
+{
+  return (g >= RETN_GRAN_MINUTE && g <= RETN_GRAN_MONTH) ? gran_names[g] : "?";
+}
+
+
+// ---- single-pass JSON scanner over the mmap'ed file (no DOM) ----
+
+typedef struct tagJSCAN {
+  const char *base, *p, *end;
+  const char *err;          // first error message, NULL if none
+} JSCAN;
+
+#define JS_MAX_DEPTH 64
+
+static void js_fail(JSCAN *js, const char *msg)
+{
+  if (!js->err)
+    js->err = msg;
+}
+
+static void js_ws(JSCAN *js)
+{
+  while (js->p < js->end &&
+      (*js->p == ' ' || *js->p == '\t' || *js->p == '\n' || *js->p == '\r'))
+    js->p++;
+}
+
+static bool js_peek(JSCAN *js, char c)
+{
+  js_ws(js);
+  return js->p < js->end && *js->p == c;
+}
+
+static bool js_expect(JSCAN *js, char c)
+{
+  if (!js_peek(js, c)) {
+    js_fail(js, "unexpected character");
+    return false;
+  }
+  js->p++;
+  return true;
+}
+
+// raw span between the quotes; escapes are kept as they are (ids and unit
+// names never need them, and a span that contains one simply won't match)
+static bool js_string(JSCAN *js, const char **s, size_t *len)
+{
+  if (!js_expect(js, '"'))
+    return false;
+  const char *start = js->p;
+  while (js->p < js->end && *js->p != '"') {
+    if (*js->p == '\\')
+      js->p++;
+    js->p++;
+  }
+  if (js->p >= js->end) {
+    js_fail(js, "unterminated string");
+    return false;
+  }
+  *s = start;
+  *len = (size_t)(js->p - start);
+  js->p++;
+  return true;
+}
+
+#define JS_NUMBER_MAX 100000000L   // days / seconds; anything larger is a typo
+
+static bool js_digits(JSCAN *js)
+{
+  const char *start = js->p;
+  while (js->p < js->end && *js->p >= '0' && *js->p <= '9')
+    js->p++;
+  return js->p != start;
+}
+
+// any JSON number: -?digits(.digits)?([eE][+-]?digits)?, valued with strtod
+static bool js_scan_number(JSCAN *js, double *out)
+{
+  js_ws(js);
+  const char *start = js->p;
+  if (js->p < js->end && *js->p == '-')
+    js->p++;
+  bool ok = js_digits(js);
+  if (ok && js->p < js->end && *js->p == '.') {
+    js->p++;
+    ok = js_digits(js);
+  }
+  if (ok && js->p < js->end && (*js->p == 'e' || *js->p == 'E')) {
+    js->p++;
+    if (js->p < js->end && (*js->p == '+' || *js->p == '-'))
+      js->p++;
+    ok = js_digits(js);
+  }
+  char buf[64];
+  size_t len = (size_t)(js->p - start);
+  if (!ok || len >= sizeof(buf)) {
+    js_fail(js, "number expected");
+    return false;
+  }
+  // the file is not NUL-terminated, so strtod gets a copy of the span
+  memcpy(buf, start, len);
+  buf[len] = '\0';
+  *out = strtod(buf, NULL);
+  return true;
+}
+
+// days / seconds: a whole number in 0..JS_NUMBER_MAX (1e3 and 3.65e2 are fine,
+// 1.5, -1 and 1e12 are errors rather than truncated or clamped)
+static bool js_number(JSCAN *js, long *out)
+{
+  double v;
+  if (!js_scan_number(js, &v))
+    return false;
+  if (v < 0) {
+    js_fail(js, "negative number");
+    return false;
+  }
+  if (v > (double)JS_NUMBER_MAX) {
+    js_fail(js, "number too large");
+    return false;
+  }
+  if (v != (double)(long)v) {
+    js_fail(js, "whole number expected");
+    return false;
+  }
+  *out = (long)v;
+  return true;
+}
+
+static bool js_skip_value(JSCAN *js, int depth)
+{
+  const char *s;
+  size_t len;
+
+  if (depth > JS_MAX_DEPTH) {
+    js_fail(js, "nesting too deep");
+    return false;
+  }
+  js_ws(js);
+  if (js->p >= js->end) {
+    js_fail(js, "unexpected end of file");
+    return false;
+  }
+
+  switch (*js->p) {
+    case '"':
+      return js_string(js, &s, &len);
+    case '{':
+    case '[': {
+      char close = (*js->p == '{') ? '}' : ']';
+      bool obj = (close == '}');
+      js->p++;
+      if (js_peek(js, close)) { js->p++; return true; }
+      for (;;) {
+        if (obj && !(js_string(js, &s, &len) && js_expect(js, ':')))
+          return false;
+        if (!js_skip_value(js, depth + 1))
+          return false;
+        if (js_peek(js, ',')) { js->p++; continue; }
+        return js_expect(js, close);
+      }
+    }
+    default: {
+      if (*js->p == '-' || (*js->p >= '0' && *js->p <= '9')) {
+        double v;
+        return js_scan_number(js, &v);
+      }
+      static const char *lit[] = { "true", "false", "null" };
+      for (int i = 0; i < 3; i++) {
+        size_t n = strlen(lit[i]);
+        if ((size_t)(js->end - js->p) >= n && memcmp(js->p, lit[i], n) == 0) {
+          js->p += n;
+          return true;
+        }
+      }
+      js_fail(js, "invalid value");
+      return false;
+    }
+  }
+}
+
+// object member iteration:  js_expect(js,'{') then
+//   while ((r = js_member(js, &first, &k, &klen)) > 0) { ...parse value... }
+// returns 1 for a member (positioned at its value), 0 at '}', -1 on error
+static int js_member(JSCAN *js, bool *first, const char **key, size_t *klen)
+{
+  if (js_peek(js, '}')) {
+    js->p++;
+    return 0;
+  }
+  if (!*first && !js_expect(js, ','))
+    return -1;
+  *first = false;
+  if (!js_string(js, key, klen) || !js_expect(js, ':'))
+    return -1;
+  return 1;
+}
+
+static bool span_eq(const char *s, size_t len, const char *lit)
+{
+  return strlen(lit) == len && memcmp(s, lit, len) == 0;
+}
+
+// false with js->err unset: well-formed but unknown unit name
+static bool js_gran(JSCAN *js, RETN_GRAN *out)
+{
+  const char *s;
+  size_t len;
+
+  if (!js_peek(js, '"')) {
+    js_skip_value(js, 1);   // not a string: unknown unit (js->err set if malformed)
+    return false;
+  }
+  if (!js_string(js, &s, &len))
+    return false;
+  for (int g = RETN_GRAN_MINUTE; g <= RETN_GRAN_MONTH; g++) {
+    if (span_eq(s, len, gran_names[g])) {
+      *out = (RETN_GRAN)g;
+      return true;
+    }
+  }
+  return false;
+}
+
+
+// ---- hash index ----
+
+static uint32_t hash_id(const char *s, size_t n)
+{
+  uint32_t h = 2166136261u;   // FNV-1a
+  for (size_t i = 0; i < n; i++) {
+    h ^= (unsigned char)s[i];
+    h *= 16777619u;
+  }
+  return h;
+}
+
+static int64_t find_company(const RETN_CONFIG *pConfig, const char *cid, size_t len)
+{
+  if (pConfig->nslot == 0)
+    return -1;
+
+  uint32_t mask = pConfig->nslot - 1;
+  for (uint32_t i = hash_id(cid, len) & mask; pConfig->slot[i]; i = (i + 1) & mask) {
+    const RETN_COMPANY *c = &pConfig->company[pConfig->slot[i] - 1];
+    if (c->name_len == len && memcmp(pConfig->strtab + c->name_off, cid, len) == 0)
+      return pConfig->slot[i] - 1;
+  }
+  return -1;
+}
+
+static bool grow_slots(RETN_CONFIG *pConfig)
+{
+  uint32_t n = pConfig->nslot ? pConfig->nslot * 2 : 1024;
+  uint32_t *ns = (uint32_t *)calloc(n, sizeof(uint32_t));
+  if (ns == NULL)
+    return false;
+
+  for (uint32_t id = 0; id < pConfig->count; id++) {
+    const RETN_COMPANY *c = &pConfig->company[id];
+    uint32_t i = hash_id(pConfig->strtab + c->name_off, c->name_len) & (n - 1);
+    while (ns[i])
+      i = (i + 1) & (n - 1);
+    ns[i] = id + 1;
+  }
+  free(pConfig->slot);
+  pConfig->slot = ns;
+  pConfig->nslot = n;
+  return true;
+}
+
+static int64_t strtab_add(RETN_CONFIG *pConfig, const char *s, size_t len)
+{
+  if (pConfig->strtab_len + len + 1 > pConfig->strtab_cap) {
+    size_t ncap = pConfig->strtab_cap ? pConfig->strtab_cap * 2 : 4096;
+    while (ncap < pConfig->strtab_len + len + 1)
+      ncap *= 2;
+    char *nt = (char *)realloc(pConfig->strtab, ncap);
+    if (nt == NULL)
+      return -1;
+    pConfig->strtab = nt;
+    pConfig->strtab_cap = ncap;
+  }
+  size_t off = pConfig->strtab_len;
+  memcpy(pConfig->strtab + off, s, len);
+  pConfig->strtab[off + len] = '\0';
+  pConfig->strtab_len += len + 1;
+  return (int64_t)off;
+}
+
+// a later duplicate of the same id overrides the earlier one
+static RETN_COMPANY *company_upsert(RETN_CONFIG *pConfig, const char *cid, size_t len)
+{
+  int64_t id = find_company(pConfig, cid, len);
+  if (id >= 0)
+    return &pConfig->company[id];
+
+  if (2 * (pConfig->count + 1) > pConfig->nslot && !grow_slots(pConfig))
+    return NULL;
+  if (pConfig->count == pConfig->cap) {
+    uint32_t ncap = pConfig->cap ? pConfig->cap * 2 : 256;
+    RETN_COMPANY *nc = (RETN_COMPANY *)realloc(pConfig->company, ncap * sizeof(RETN_COMPANY));
+    if (nc == NULL)
+      return NULL;
+    pConfig->company = nc;
+    pConfig->cap = ncap;
+  }
+  int64_t off = strtab_add(pConfig, cid, len);
+  if (off < 0)
+    return NULL;
+
+  uint32_t n = pConfig->count++;
+  RETN_COMPANY *c = &pConfig->company[n];
+  memset(c, 0, sizeof(*c));
+  c->name_off = (uint32_t)off;
+  c->name_len = (uint32_t)len;
+
+  uint32_t mask = pConfig->nslot - 1;
+  uint32_t i = hash_id(cid, len) & mask;
+  while (pConfig->slot[i])
+    i = (i + 1) & mask;
+  pConfig->slot[i] = n + 1;
+  return c;
+}
+
+static int64_t device_add(RETN_CONFIG *pConfig, const char *dev, size_t len,
+    long days, RETN_GRAN g)
+{
+  if (pConfig->ndevice == pConfig->device_cap) {
+    uint32_t ncap = pConfig->device_cap ? pConfig->device_cap * 2 : 256;
+    RETN_DEVICE *nd = (RETN_DEVICE *)realloc(pConfig->device, ncap * sizeof(RETN_DEVICE));
+    if (nd == NULL)
+      return -1;
+    pConfig->device = nd;
+    pConfig->device_cap = ncap;
+  }
+  int64_t off = strtab_add(pConfig, dev, len);
+  if (off < 0)
+    return -1;
+
+  RETN_DEVICE *d = &pConfig->device[pConfig->ndevice];
+  d->name_off = (uint32_t)off;
+  d->name_len = (uint32_t)len;
+  d->retention_days = (int32_t)days;
+  d->granularity = (int32_t)g;
+  return pConfig->ndevice++;
+}
+
+// Second level: devices [first, first+n) get their own small hash range in
+// device_slot, hung off the company. Built once the company's object has
+// been read; a later duplicate of a device id wins.
+static bool build_device_index(RETN_CONFIG *pConfig, RETN_COMPANY *c,
+    uint32_t first, uint32_t n)
+{
+  uint32_t nslot = 4;
+  while (nslot < 2 * n)
+    nslot *= 2;
+
+  if (pConfig->ndevice_slot + nslot > pConfig->device_slot_cap) {
+    uint32_t ncap = pConfig->device_slot_cap ? pConfig->device_slot_cap * 2 : 1024;
+    while (ncap < pConfig->ndevice_slot + nslot)
+      ncap *= 2;
+    uint32_t *ns = (uint32_t *)realloc(pConfig->device_slot, ncap * sizeof(uint32_t));
+    if (ns == NULL)
+      return false;
+    pConfig->device_slot = ns;
+    pConfig->device_slot_cap = ncap;
+  }
+  uint32_t *slot = pConfig->device_slot + pConfig->ndevice_slot;
+  memset(slot, 0, nslot * sizeof(uint32_t));
+
+  for (uint32_t id = first; id < first + n; id++) {
+    const RETN_DEVICE *d = &pConfig->device[id];
+    const char *name = pConfig->strtab + d->name_off;
+    uint32_t i = hash_id(name, d->name_len) & (nslot - 1);
+    while (slot[i]) {
+      const RETN_DEVICE *o = &pConfig->device[slot[i] - 1];
+      if (o->name_len == d->name_len && memcmp(pConfig->strtab + o->name_off, name, d->name_len) == 0)
+        break;
+      i = (i + 1) & (nslot - 1);
+    }
+    slot[i] = id + 1;
+  }
+
+  c->dev_slot_off = pConfig->ndevice_slot;
+  c->dev_nslot = nslot;
+  pConfig->ndevice_slot += nslot;
+  return true;
+}
+
+
+// ---- config.json structure ----
+
+// "did": days  or  "did": { "default": days, "granularity": "hour" }
+// (-1: the company's value, resolved at lookup)
+static bool parse_device_value(JSCAN *js, long *days, RETN_GRAN *g)
+{
+  *days = -1;
+  *g = (RETN_GRAN)-1;
+
+  if (!js_peek(js, '{'))
+    return js_number(js, days);
+
+  const char *k;
+  size_t klen;
+  bool first = true;
+  int r;
+
+  js->p++;
+  while ((r = js_member(js, &first, &k, &klen)) > 0) {
+    if (span_eq(k, klen, "default")) {
+      if (!js_number(js, days))
+        return false;
+    }
+    else if (span_eq(k, klen, "granularity")) {
+      if (!js_gran(js, g) && js->err)
+        return false;
+    }
+    else if (!js_skip_value(js, 1))
+      return false;
+  }
+  return r == 0;
+}
+
+// "devices": { "did": ..., ... }  appended to the device table
+static bool parse_devices(JSCAN *js, RETN_CONFIG *pConfig, const char *cid, size_t len)
+{
+  const char *k;
+  size_t klen;
+  bool first = true;
+  int r;
+
+  if (!js_expect(js, '{'))
+    return false;
+
+  while ((r = js_member(js, &first, &k, &klen)) > 0) {
+    long days;
+    RETN_GRAN g;
+
+    if (!js_peek(js, '{') && !js_peek(js, '-') &&
+        !(js->p < js->end && *js->p >= '0' && *js->p <= '9')) {
+      fprintf(stderr, " Warning: ignoring device %.*s/%.*s: not a number or object\n",
+          (int)len, cid, (int)klen, k);
+      if (!js_skip_value(js, 1))
+        return false;
+      continue;
+    }
+    if (!parse_device_value(js, &days, &g))
+      return false;
+    if (device_add(pConfig, k, klen, days, g) < 0) {
+      js_fail(js, "out of memory");
+      return false;
+    }
+  }
+  return r == 0;
+}
+
+// "cid": days  or
+// "cid": { "default": days, "granularity": "hour", "devices": { "did": days } }
+static bool parse_company(JSCAN *js, RETN_CONFIG *pConfig, const char *cid, size_t len)
+{
+  long days = -1;             // -1 / -1: inherit, resolved after the whole file
+  RETN_GRAN g = (RETN_GRAN)-1;
+  uint32_t dev_first = pConfig->ndevice;
+  bool has_devices = false;
+
+  if (js_peek(js, '{')) {
+    const char *k;
+    size_t klen;
+    bool first = true;
+    int r;
+
+    js->p++;
+    while ((r = js_member(js, &first, &k, &klen)) > 0) {
+      if (span_eq(k, klen, "default")) {
+        if (!js_number(js, &days))
+          return false;
+      }
+      else if (span_eq(k, klen, "granularity")) {
+        if (!js_gran(js, &g)) {
+          if (js->err)
+            return false;
+          fprintf(stderr, " Warning: unknown granularity for company %.*s\n", (int)len, cid);
+        }
+      }
+      else if (span_eq(k, klen, "devices")) {
+        // a repeated "devices" object replaces the earlier one
+        dev_first = pConfig->ndevice;
+        if (!parse_devices(js, pConfig, cid, len))
+          return false;
+        has_devices = true;
+      }
+      else if (!js_skip_value(js, 1))
+        return false;
+    }
+    if (r < 0)
+      return false;
+  }
+  else if (js_peek(js, '-') || (js->p < js->end && *js->p >= '0' && *js->p <= '9')) {
+    if (!js_number(js, &days))
+      return false;
+  }
+  else
+    return js_skip_value(js, 1);
+
+  RETN_COMPANY *c = company_upsert(pConfig, cid, len);
+  if (c == NULL) {
+    js_fail(js, "out of memory");
+    return false;
+  }
+  c->retention_days = (int32_t)days;
+  c->granularity = (int32_t)g;
+  c->dev_slot_off = 0;
+  c->dev_nslot = 0;
+  if (has_devices && pConfig->ndevice > dev_first &&
+      !build_device_index(pConfig, c, dev_first, pConfig->ndevice - dev_first)) {
+    js_fail(js, "out of memory");
+    return false;
+  }
+  return true;
+}
+
+static bool parse_retention(JSCAN *js, RETN_CONFIG *pConfig)
+{
+  const char *k;
+  size_t klen;
+  bool first = true;
+  int r;
+
+  if (!js_expect(js, '{'))
+    return false;
+
+  while ((r = js_member(js, &first, &k, &klen)) > 0) {
+    // default days parsing
+    if (span_eq(k, klen, "default")) {
+      long v;
+      if (!js_number(js, &v))
+        return false;
+      pConfig->default_days = (int)v;
+    }
+    else if (!parse_company(js, pConfig, k, klen))
+      return false;
+  }
+  return r == 0;
+}
+
+static bool parse_root(JSCAN *js, RETN_CONFIG *pConfig, bool *has_retention)
+{
+  const char *k;
+  size_t klen;
+  bool first = true;
+  int r;
+
+  if (!js_expect(js, '{'))
+    return false;
+
+  while ((r = js_member(js, &first, &k, &klen)) > 0) {
+    if (span_eq(k, klen, "retention")) {
+      if (!parse_retention(js, pConfig))
+        return false;
+      *has_retention = true;
+    }
+    else if (span_eq(k, klen, "granularity")) {
+      if (!js_gran(js, &pConfig->default_gran)) {
+        if (js->err)
+          return false;
+        fprintf(stderr, " Warning: unknown granularity, using %s\n",
+            retn_gran_name(pConfig->default_gran));
+      }
+    }
+    else if (span_eq(k, klen, "spread_window")) {
+      long v;
+      if (!js_number(js, &v))
+        return false;
+      pConfig->spread_window = (int)v;
+    }
+    else if (!js_skip_value(js, 1))
+      return false;
+  }
+  return r == 0;
+}
+
+static void report_error(const char *path, const JSCAN *js)
+{
+  int line = 1, col = 1;
+  for (const char *q = js->base; q < js->p && q < js->end; q++) {
+    if (*q == '\n') { line++; col = 1; }
+    else col++;
+  }
+  fprintf(stderr, "Error JSON parsing %s:%d:%d: %s\n", path, line, col,
+      js->err ? js->err : "syntax error");
+}
+
+
+void retn_config_free(RETN_CONFIG *pConfig)
+{
+  if (pConfig->map) {
+    munmap(pConfig->map, pConfig->map_len);
+    pConfig->map = NULL;
+    pConfig->map_len = 0;
+  }
+  else {
+    free(pConfig->company);
+    free(pConfig->slot);
+    free(pConfig->strtab);
+    free(pConfig->device);
+    free(pConfig->device_slot);
+  }
+  pConfig->company = NULL;
+  pConfig->slot = NULL;
+  pConfig->strtab = NULL;
+  pConfig->device = NULL;
+  pConfig->device_slot = NULL;
+  pConfig->count = pConfig->cap = pConfig->nslot = 0;
+  pConfig->strtab_len = pConfig->strtab_cap = 0;
+  pConfig->ndevice = pConfig->device_cap = 0;
+  pConfig->ndevice_slot = pConfig->device_slot_cap = 0;
+}
+
+
+size_t retn_config_mem(const RETN_CONFIG *pConfig)
+{
+  if (pConfig->map)
+    return pConfig->map_len;
+  return pConfig->cap * sizeof(RETN_COMPANY) + pConfig->nslot * sizeof(uint32_t) +
+    pConfig->device_cap * sizeof(RETN_DEVICE) + pConfig->device_slot_cap * sizeof(uint32_t) +
+    pConfig->strtab_cap;
+}
+
+
+bool load_json_config(const char *path, RETN_CONFIG *pConfig)
+{
+  struct timespec t0, t1;
+  clock_gettime(CLOCK_MONOTONIC, &t0);
+
+  // initial values
+  memset(pConfig, 0, sizeof(*pConfig));
+  pConfig->default_days = 30;
+  pConfig->default_gran = RETN_GRAN_DAY;
+
+  // map the JSON file read-only; it is scanned once and never copied
+  int fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    fprintf(stderr, "Error: Unable to open %s: %s\n", path, strerror(errno));
+    return false;
+  }
+
+  struct stat sb;
+  if (fstat(fd, &sb) != 0 || sb.st_size == 0) {
+    fprintf(stderr, "Error: empty or unreadable config %s\n", path);
+    close(fd);
+    return false;
+  }
+
+  void *map = mmap(NULL, (size_t)sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED) {
+    perror("mmap");
+    return false;
+  }
+  madvise(map, (size_t)sb.st_size, MADV_SEQUENTIAL);
+
+  JSCAN js = { .base = map, .p = map, .end = (const char *)map + sb.st_size, .err = NULL };
+  bool has_retention = false;
+  bool ok = parse_root(&js, pConfig, &has_retention);
+  if (ok) {
+    js_ws(&js);
+    if (js.p != js.end) {
+      js_fail(&js, "trailing characters");
+      ok = false;
+    }
+  }
+  if (!ok)
+    report_error(path, &js);
+  else if (!has_retention) {
+    fprintf(stderr, "Error: no \"retention\" object in %s\n", path);
+    ok = false;
+  }
+  munmap(map, (size_t)sb.st_size);
+
+  if (!ok) {
+    retn_config_free(pConfig);
+    return false;
+  }
+
+  // "default" and "granularity" may come after the companies that inherit them
+  for (uint32_t i = 0; i < pConfig->count; i++) {
+    if (pConfig->company[i].retention_days < 0)
+      pConfig->company[i].retention_days = pConfig->default_days;
+    if (pConfig->company[i].granularity < 0)
+      pConfig->company[i].granularity = pConfig->default_gran;
+  }
+
+  clock_gettime(CLOCK_MONOTONIC, &t1);
+  pConfig->parse_ms = (double)(t1.tv_sec - t0.tv_sec) * 1e3 +
+    (double)(t1.tv_nsec - t0.tv_nsec) / 1e6;
+  return true;
+}
+
+
+// ---- compiled cache ----
+
+#define CACHE_MAGIC   "RETNCFG"
+#define CACHE_VERSION 1
+#define CACHE_BOM     0x01020304u   // native byte order only
+
+typedef struct tagRETN_CACHE_HDR {
+  char     magic[8];
+  uint32_t version;
+  uint32_t bom;
+  uint64_t file_size;
+  uint64_t checksum;        // over everything after the header
+
+  // the JSON file this cache was compiled from
+  int64_t  src_mtime_sec;
+  int64_t  src_mtime_nsec;
+  uint64_t src_size;
+  uint64_t src_hash;
+
+  int32_t  default_days;
+  int32_t  default_gran;
+  int32_t  spread_window;
+  uint32_t count;
+  uint32_t nslot;
+  uint32_t ndevice;
+  uint32_t ndevice_slot;
+  uint32_t reserved;
+
+  // section offsets from the start of the file, 8-byte aligned
+  uint64_t off_company, off_slot, off_device, off_device_slot, off_strtab;
+  uint64_t strtab_len;
+} RETN_CACHE_HDR;
+
+// word-at-a-time hash; used for the checksum and for the JSON source hash
+static uint64_t hash_bytes(const void *data, size_t len)
+{
+  const unsigned char *p = (const unsigned char *)data;
+  uint64_t h = 0xcbf29ce484222325ULL ^ len;
+  uint64_t w;
+
+  for (; len >= 8; p += 8, len -= 8) {
+    memcpy(&w, p, 8);
+    h = (h ^ w) * 0x100000001b3ULL;
+    h ^= h >> 29;
+  }
+  w = 0;
+  memcpy(&w, p, len);
+  h = (h ^ w) * 0x100000001b3ULL;
+  return h ^ (h >> 32);
+}
+
+static bool hash_file(const char *path, uint64_t *out)
+{
+  int fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0)
+    return false;
+
+  struct stat sb;
+  if (fstat(fd, &sb) != 0 || sb.st_size == 0) {
+    close(fd);
+    return false;
+  }
+  void *map = mmap(NULL, (size_t)sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED)
+    return false;
+  *out = hash_bytes(map, (size_t)sb.st_size);
+  munmap(map, (size_t)sb.st_size);
+  return true;
+}
+
+static size_t align8(size_t n)
+{
+  return (n + 7) & ~(size_t)7;
+}
+
+static bool write_all(int fd, const void *buf, size_t len)
+{
+  const char *p = (const char *)buf;
+  while (len > 0) {
+    ssize_t n = write(fd, p, len);
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      return false;
+    }
+    p += n;
+    len -= (size_t)n;
+  }
+  return true;
+}
+
+
+bool retn_compile_config(const char *json_path, const char *cache_path)
+{
+  RETN_CONFIG cfg;
+  struct stat sb;
+  uint64_t src_hash;
+
+  if (stat(json_path, &sb) != 0 || !hash_file(json_path, &src_hash)) {
+    fprintf(stderr, "Error: Unable to read %s: %s\n", json_path, strerror(errno));
+    return false;
+  }
+  if (!load_json_config(json_path, &cfg))
+    return false;
+
+  RETN_CACHE_HDR hdr;
+  memset(&hdr, 0, sizeof(hdr));
+  memcpy(hdr.magic, CACHE_MAGIC, sizeof(CACHE_MAGIC));
+  hdr.version = CACHE_VERSION;
+  hdr.bom = CACHE_BOM;
+  hdr.src_mtime_sec = (int64_t)sb.st_mtim.tv_sec;
+  hdr.src_mtime_nsec = (int64_t)sb.st_mtim.tv_nsec;
+  hdr.src_size = (uint64_t)sb.st_size;
+  hdr.src_hash = src_hash;
+  hdr.default_days = cfg.default_days;
+  hdr.default_gran = cfg.default_gran;
+  hdr.spread_window = cfg.spread_window;
+  hdr.count = cfg.count;
+  hdr.nslot = cfg.nslot;
+  hdr.ndevice = cfg.ndevice;
+  hdr.ndevice_slot = cfg.ndevice_slot;
+  hdr.strtab_len = cfg.strtab_len;
+
+  // lay the tables out back to back, each 8-byte aligned
+  size_t off = align8(sizeof(hdr));
+  hdr.off_company = off;     off = align8(off + (size_t)cfg.count * sizeof(RETN_COMPANY));
+  hdr.off_slot = off;        off = align8(off + (size_t)cfg.nslot * sizeof(uint32_t));
+  hdr.off_device = off;      off = align8(off + (size_t)cfg.ndevice * sizeof(RETN_DEVICE));
+  hdr.off_device_slot = off; off = align8(off + (size_t)cfg.ndevice_slot * sizeof(uint32_t));
+  hdr.off_strtab = off;      off = align8(off + cfg.strtab_len);
+  hdr.file_size = off;
+
+  char *buf = (char *)calloc(1, off);
+  if (buf == NULL) {
+    retn_config_free(&cfg);
+    return false;
+  }
+  if (cfg.count)
+    memcpy(buf + hdr.off_company, cfg.company, (size_t)cfg.count * sizeof(RETN_COMPANY));
+  if (cfg.nslot)
+    memcpy(buf + hdr.off_slot, cfg.slot, (size_t)cfg.nslot * sizeof(uint32_t));
+  if (cfg.ndevice)
+    memcpy(buf + hdr.off_device, cfg.device, (size_t)cfg.ndevice * sizeof(RETN_DEVICE));
+  if (cfg.ndevice_slot)
+    memcpy(buf + hdr.off_device_slot, cfg.device_slot, (size_t)cfg.ndevice_slot * sizeof(uint32_t));
+  if (cfg.strtab_len)
+    memcpy(buf + hdr.off_strtab, cfg.strtab, cfg.strtab_len);
+  hdr.checksum = hash_bytes(buf + sizeof(hdr), off - sizeof(hdr));
+  memcpy(buf, &hdr, sizeof(hdr));
+  retn_config_free(&cfg);
+
+  // write next to the target and rename, so a running cleaner never maps a half-written file
+  char tmp[PATH_MAX];
+  if (snprintf(tmp, sizeof(tmp), "%s.tmp.%ld", cache_path, (long)getpid()) >= (int)sizeof(tmp)) {
+    free(buf);
+    return false;
+  }
+  int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (fd < 0) {
+    fprintf(stderr, "Error: Unable to create %s: %s\n", tmp, strerror(errno));
+    free(buf);
+    return false;
+  }
+  bool ok = write_all(fd, buf, off) && fsync(fd) == 0;
+  ok = (close(fd) == 0) && ok;
+  free(buf);
+  if (!ok || rename(tmp, cache_path) != 0) {
+    fprintf(stderr, "Error: Unable to write %s: %s\n", cache_path, strerror(errno));
+    unlink(tmp);
+    return false;
+  }
+  return true;
+}
+
+
+// a section lies inside the file, after the header, 8-byte aligned
+static bool section_ok(uint64_t off, uint64_t bytes, size_t len)
+{
+  return off % 8 == 0 && off >= sizeof(RETN_CACHE_HDR) && off <= len && bytes <= len - off;
+}
+
+// an open addressing table must hold indices in 1..n and keep an empty slot,
+// or a lookup would read past the entries or probe forever
+static bool slots_ok(const uint32_t *slot, uint32_t nslot, uint32_t n)
+{
+  bool empty = false;
+  for (uint32_t i = 0; i < nslot; i++) {
+    if (slot[i] > n)
+      return false;
+    empty |= (slot[i] == 0);
+  }
+  return empty;
+}
+
+static bool name_ok(uint32_t off, uint32_t len, uint64_t strtab_len)
+{
+  return (uint64_t)off + len <= strtab_len;
+}
+
+// The checksum only catches damage. The tables are used in place, so every
+// index the lookups follow is checked once here as well.
+static bool cache_tables_ok(const RETN_CACHE_HDR *hdr, const char *base)
+{
+  if (hdr->default_days < 0 || hdr->spread_window < 0 ||
+      hdr->default_gran < RETN_GRAN_MINUTE || hdr->default_gran > RETN_GRAN_MONTH)
+    return false;
+
+  const RETN_COMPANY *company = (const RETN_COMPANY *)(base + hdr->off_company);
+  const RETN_DEVICE *device = (const RETN_DEVICE *)(base + hdr->off_device);
+  const uint32_t *device_slot = (const uint32_t *)(base + hdr->off_device_slot);
+
+  if (hdr->nslot && !slots_ok((const uint32_t *)(base + hdr->off_slot), hdr->nslot, hdr->count))
+    return false;
+  for (uint32_t i = 0; i < hdr->count; i++) {
+    const RETN_COMPANY *c = &company[i];
+    if (!name_ok(c->name_off, c->name_len, hdr->strtab_len) || c->retention_days < 0 ||
+        c->granularity < RETN_GRAN_MINUTE || c->granularity > RETN_GRAN_MONTH)
+      return false;
+    if (c->dev_nslot &&
+        ((c->dev_nslot & (c->dev_nslot - 1)) != 0 ||
+         (uint64_t)c->dev_slot_off + c->dev_nslot > hdr->ndevice_slot ||
+         !slots_ok(device_slot + c->dev_slot_off, c->dev_nslot, hdr->ndevice)))
+      return false;
+  }
+  for (uint32_t i = 0; i < hdr->ndevice; i++) {
+    const RETN_DEVICE *d = &device[i];
+    if (!name_ok(d->name_off, d->name_len, hdr->strtab_len) || d->retention_days < -1 ||
+        d->granularity < -1 || d->granularity > RETN_GRAN_MONTH)
+      return false;
+  }
+  return true;
+}
+
+
+// maps and validates the cache; false (quietly) if it cannot be used
+static bool load_cache(const char *json_path, const char *cache_path, RETN_CONFIG *pConfig)
+{
+  int fd = open(cache_path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0)
+    return false;
+
+  struct stat sb;
+  if (fstat(fd, &sb) != 0 || (size_t)sb.st_size < sizeof(RETN_CACHE_HDR)) {
+    close(fd);
+    return false;
+  }
+  size_t len = (size_t)sb.st_size;
+  void *map = mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED)
+    return false;
+
+  const RETN_CACHE_HDR *hdr = (const RETN_CACHE_HDR *)map;
+  const char *why = NULL;
+  struct stat js;
+
+  if (memcmp(hdr->magic, CACHE_MAGIC, sizeof(CACHE_MAGIC)) != 0 ||
+      hdr->version != CACHE_VERSION || hdr->bom != CACHE_BOM || hdr->file_size != len)
+    why = "unknown format";
+  else if (!section_ok(hdr->off_company, (uint64_t)hdr->count * sizeof(RETN_COMPANY), len) ||
+      !section_ok(hdr->off_slot, (uint64_t)hdr->nslot * sizeof(uint32_t), len) ||
+      !section_ok(hdr->off_device, (uint64_t)hdr->ndevice * sizeof(RETN_DEVICE), len) ||
+      !section_ok(hdr->off_device_slot, (uint64_t)hdr->ndevice_slot * sizeof(uint32_t), len) ||
+      !section_ok(hdr->off_strtab, hdr->strtab_len, len) || (hdr->nslot & (hdr->nslot - 1)) != 0)
+    why = "bad section table";
+  else if (hash_bytes((const char *)map + sizeof(*hdr), len - sizeof(*hdr)) != hdr->checksum)
+    why = "checksum mismatch";
+  else if (!cache_tables_ok(hdr, (const char *)map))
+    why = "inconsistent tables";
+  else if (stat(json_path, &js) != 0 || (uint64_t)js.st_size != hdr->src_size)
+    why = "stale";
+  else if ((int64_t)js.st_mtim.tv_sec != hdr->src_mtime_sec ||
+      (int64_t)js.st_mtim.tv_nsec != hdr->src_mtime_nsec) {
+    // touched or copied: only a content change makes the cache stale
+    uint64_t h;
+    if (!hash_file(json_path, &h) || h != hdr->src_hash)
+      why = "stale";
+  }
+
+  if (why) {
+    fprintf(stderr, " Notice: config cache %s %s, parsing JSON\n", cache_path, why);
+    munmap(map, len);
+    return false;
+  }
+
+  // zero-copy: the tables are used in place
+  const char *base = (const char *)map;
+  memset(pConfig, 0, sizeof(*pConfig));
+  pConfig->default_days = hdr->default_days;
+  pConfig->default_gran = (RETN_GRAN)hdr->default_gran;
+  pConfig->spread_window = hdr->spread_window;
+  pConfig->company = (RETN_COMPANY *)(base + hdr->off_company);
+  pConfig->count = hdr->count;
+  pConfig->slot = (uint32_t *)(base + hdr->off_slot);
+  pConfig->nslot = hdr->nslot;
+  pConfig->device = (RETN_DEVICE *)(base + hdr->off_device);
+  pConfig->ndevice = hdr->ndevice;
+  pConfig->device_slot = (uint32_t *)(base + hdr->off_device_slot);
+  pConfig->ndevice_slot = hdr->ndevice_slot;
+  pConfig->strtab = (char *)(base + hdr->off_strtab);
+  pConfig->strtab_len = hdr->strtab_len;
+  pConfig->map = map;
+  pConfig->map_len = len;
+  return true;
+}
+
+
+bool retn_load_config(const char *json_path, RETN_CONFIG *pConfig)
+{
+  struct timespec t0, t1;
+  char cache_path[PATH_MAX];
+
+  clock_gettime(CLOCK_MONOTONIC, &t0);
+  if (snprintf(cache_path, sizeof(cache_path), "%s%s", json_path, RETN_CACHE_SUFFIX) <
+        (int)sizeof(cache_path) &&
+      load_cache(json_path, cache_path, pConfig)) {
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    pConfig->parse_ms = (double)(t1.tv_sec - t0.tv_sec) * 1e3 +
+      (double)(t1.tv_nsec - t0.tv_nsec) / 1e6;
+    return true;
+  }
+  return load_json_config(json_path, pConfig);
+}
+
+
+const RETN_COMPANY *retn_find_company(const RETN_CONFIG *pConfig, const char *cid, size_t len)
+{
+  int64_t id = find_company(pConfig, cid, len);
+  return id >= 0 ? &pConfig->company[id] : NULL;
+}
+
+
+RETN_POLICY retn_company_policy(const RETN_CONFIG *pConfig, const RETN_COMPANY *c)
+{
+  RETN_POLICY p = { pConfig->default_days, pConfig->default_gran }; //default
+
+  if (c != NULL) {
+    p.retention_days = c->retention_days;
+    p.granularity    = (RETN_GRAN)c->granularity;
+  }
+  return p;
+}
+
+
+RETN_POLICY retn_device_policy(const RETN_CONFIG *pConfig, const RETN_COMPANY *c,
+    const char *dev, size_t len)
+{
+  RETN_POLICY p = retn_company_policy(pConfig, c);
+
+  if (c == NULL || c->dev_nslot == 0)
+    return p;
+
+  const uint32_t *slot = pConfig->device_slot + c->dev_slot_off;
+  uint32_t mask = c->dev_nslot - 1;
+  for (uint32_t i = hash_id(dev, len) & mask; slot[i]; i = (i + 1) & mask) {
+    const RETN_DEVICE *d = &pConfig->device[slot[i] - 1];
+    if (d->name_len == len && memcmp(pConfig->strtab + d->name_off, dev, len) == 0) {
+      if (d->retention_days >= 0)
+        p.retention_days = d->retention_days;
+      if (d->granularity >= 0)
+        p.granularity = (RETN_GRAN)d->granularity;
+      break;
+    }
+  }
+  return p;
+}
+
+
+time_t retn_unit_floor(time_t t, RETN_GRAN g)
+{
+  switch (g) {
+    case RETN_GRAN_MINUTE: return t - t % 60;
+    case RETN_GRAN_HOUR:   return t - t % 3600;
+    case RETN_GRAN_DAY:    return t - t % 86400;
+    case RETN_GRAN_MONTH: {
+      struct tm tmv;
+      gmtime_r(&t, &tmv);
+      tmv.tm_mday = 1;
+      tmv.tm_hour = tmv.tm_min = tmv.tm_sec = 0;
+      return timegm(&tmv);
+    }
+  }
+  return t;
+}
+
+
+time_t retn_unit_expire(time_t unit_start, RETN_GRAN g, int retention_days)
+{
+  time_t newest_day = unit_start;
+
+  if (g == RETN_GRAN_MONTH) {
+    struct tm tmv;
+    gmtime_r(&unit_start, &tmv);
+    tmv.tm_mon += 1;   // timegm normalizes month 12 -> next year
+    newest_day = timegm(&tmv) - 86400;
+  }
+
+  return newest_day + (time_t)retention_days * 86400;
+}
@@ -0,0 +1,109 @@
+#ifndef __RETN_CONFIG_H__
+#define __RETN_CONFIG_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+#define LEN_COMPANY_ID 8
+
+// expiry unit; the value is the number of levels above the minute directory
+// (same order as PkGran in path_key.h)
+typedef enum {
+  RETN_GRAN_MINUTE = 0, RETN_GRAN_HOUR, RETN_GRAN_DAY, RETN_GRAN_MONTH
+} RETN_GRAN;
+
+typedef struct tagRETN_POLICY {
+  int retention_days;
+  RETN_GRAN granularity;
+} RETN_POLICY;
+
+// One company; names live in the string table, so the tables hold only
+// offsets and can be copied or written out as they are.
+typedef struct tagRETN_COMPANY {
+  uint32_t name_off;
+  uint32_t name_len;
+  int32_t  retention_days;
+  int32_t  granularity;     // RETN_GRAN
+  uint32_t dev_slot_off;    // this company's device hash: device_slot[off .. off+nslot)
+  uint32_t dev_nslot;       // 0 = no per-device overrides
+} RETN_COMPANY;
+
+// per-device override inside a company (granularity -1: company's)
+typedef struct tagRETN_DEVICE {
+  uint32_t name_off;
+  uint32_t name_len;
+  int32_t  retention_days;
+  int32_t  granularity;
+} RETN_DEVICE;
+
+typedef struct tagRETN_CONFIG {
+  int default_days;
+  RETN_GRAN default_gran;
+  int spread_window;      // seconds; per-device deterministic expiry delay (0: off)
+
+  RETN_COMPANY *company;  // companies in file order
+  uint32_t count, cap;
+  uint32_t *slot;         // open addressing hash: company index + 1, 0 = empty
+  uint32_t nslot;         // power of two
+  char *strtab;
+  size_t strtab_len, strtab_cap;
+
+  // second level: company -> device overrides
+  RETN_DEVICE *device;
+  uint32_t ndevice, device_cap;
+  uint32_t *device_slot;  // per-company hash ranges: device index + 1, 0 = empty
+  uint32_t ndevice_slot, device_slot_cap;
+
+  double parse_ms;        // last load: wall time spent parsing / mapping
+  void *map;              // set when the tables point into a mapped cache file
+  size_t map_len;
+} RETN_CONFIG;
+
+// load config.json into RETN_CONFIG object
+//   { "granularity": "day", "spread_window": 21600,
+//     "retention": { "default": 30, "1001": 60,
+//                    "1017": { "default": 120, "granularity": "hour",
+//                              "devices": { "2002": 10, "2003": 400 } } } }
+// The file is mmap'ed and parsed in one pass straight into the hash index.
+bool load_json_config(const char *path, RETN_CONFIG *pConfig);
+void retn_config_free(RETN_CONFIG *pConfig);
+
+// bytes held by the tables of a loaded config
+size_t retn_config_mem(const RETN_CONFIG *pConfig);
+
+// Compiled cache, "<config>.bin" next to the JSON file:
+//   header (magic, version, byte order, checksum, source mtime/size/hash)
+//   followed by the company, slot, device and string tables as they are in memory.
+// retn_compile_config() parses the JSON and writes the cache (tmp file + rename).
+// retn_load_config() maps a valid cache zero-copy: the tables point into the
+// mapping. It falls back to load_json_config() when the cache is missing,
+// corrupt, or does not match the JSON file. A changed mtime alone does not make
+// the cache stale; the JSON is then hashed and compared.
+#define RETN_CACHE_SUFFIX ".bin"
+bool retn_compile_config(const char *json_path, const char *cache_path);
+bool retn_load_config(const char *json_path, RETN_CONFIG *pConfig);
+
+// Two-level lookup, meant to be done once per company / device subtree by the
+// walker and cached in its traversal context:
+//   c   = retn_find_company(cfg, cid, len);        NULL if not configured
+//   pol = retn_device_policy(cfg, c, dev, len);     device, else company, else default
+const RETN_COMPANY *retn_find_company(const RETN_CONFIG *pConfig, const char *cid, size_t len);
+RETN_POLICY retn_company_policy(const RETN_CONFIG *pConfig, const RETN_COMPANY *c);
+RETN_POLICY retn_device_policy(const RETN_CONFIG *pConfig, const RETN_COMPANY *c,
+    const char *dev, size_t len);
+
+const char *retn_gran_name(RETN_GRAN g);
+
+// start of the unit containing t (UTC)
+time_t retn_unit_floor(time_t t, RETN_GRAN g);
+
+// A unit expires once its newest calendar day is retention_days old, i.e.
+// max(unit_start, unit_end - 1 day) + retention_days. For day units this is
+// the historical "day start + retention" rule; month units wait for their
+// last day, and hour/minute units roll through the day, so no granularity
+// ever deletes data earlier than the day rule would.
+time_t retn_unit_expire(time_t unit_start, RETN_GRAN g, int retention_days);
+
+#endif //__RETN_CONFIG_H__
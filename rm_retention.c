@@ -1,8 +1,6 @@
 // Build:
-//   sudo apt install libcjson-dev
-//   gcc -O2 -Wall -o rm_retention rm_retention.c $(pkg-config --cflags --libs libcjson)
-//   or
-//   gcc -O2 -Wall -o rm_retention rm_retention.c -I/usr/include/cjson -lcjson
+//   gcc -O2 -Wall -pthread -o rm_retention rm_retention.c retn_config.c dir_purge.c vol_pool.c
+//       space_acct.c forecast.c checkpoint.c watermark.c job_queue.c io_yield.c rate_ctl.c
 
 #define _GNU_SOURCE
 #define _XOPEN_SOURCE 700
@@ -15,18 +13,83 @@
 #include <string.h>
 #include <time.h>
 #include <getopt.h>
-#include <cjson/cJSON.h>
-
-#define MAX_PATH_LEN 256
-#define MAX_TOKEN_LEN 16
-
-#define NUM_COMPANY_MAX 256
-#define LEN_COMPANY_ID 8
+#include <fcntl.h>
+#include <sys/statvfs.h>
+#include <dirent.h>
+#include <unistd.h>
+
+#include "checkpoint.h"
+#include "date_parse.h"
+#include "dir_purge.h"
+#include "forecast.h"
+#include "io_yield.h"
+#include "job_queue.h"
+#include "path_schema.h"
+#include "rate_ctl.h"
+#include "retn_config.h"
+#include "space_acct.h"
+#include "vol_pool.h"
+#include "watermark.h"
 
 // dry run global variable 
 static bool gDry_run = false;
+
+// date directories whose name is not a valid YYYY/MM/DD/HH/mm component
+// (added to atomically: every filesystem has its own worker threads)
+static unsigned long gMalformed = 0;
+
+// expired date directories removed and what was in them (atomic, like gMalformed)
+static unsigned long gDeleted_dirs = 0;
+static unsigned long gDeleted_files = 0;
+static unsigned long long gDeleted_bytes = 0;
+
+// --checkpoint FILE / --resume: progress is saved every CKPT_INTERVAL seconds
+// by whichever worker gets there first; a resumed run skips finished devices
+static const char *gCkpt_path = NULL;
+static CKPT gResume;            // loaded with --resume, nroot 0 otherwise
+static time_t gCkpt_started;
+static time_t gCkpt_last;
+static pthread_mutex_t gCkpt_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// --watermark FILE: oldest remaining date directory per device, from the
+// last run (gWm) and from this one (gWm_out[fs][unit], empty: path NULL)
+static const char *gWm_path = NULL;
+static WM_CACHE gWm;
+static WM_ENTRY **gWm_out;
+static unsigned long gWm_skipped = 0;
+
+// deleter threads per filesystem (--deleters N)
+static int gDeleters = 2;
+
+// --background: deleters run at idle I/O priority and pause under io pressure
+// (--psi-pause PCT also works on its own)
+static bool gBackground = false;
+static IY_PSI gPsi;
+
+// --unlink-threads N: threads per directory of PURGE_PAR_MIN files or more
+static int gUnlink_threads = 1;
+
+// --latency-target MS: unlink p99 the deleters' rate controller aims for
+static double gLat_target = 0;
+
+// nftw max open fds, per worker (--forecast walk)
+static int gFd_value = 32;
+
+// space accounting (--report): per-thread tables, merged after the walk.
+// Off by default, so a plain run never stats files.
+static bool gAcct_on = false;
+static SA_SET gAcct;
+
+// --forecast DAYS: nothing is removed; sizes what expires within DAYS and
+// what was written over the last FC_WINDOW_DAYS, per company
+static int gForecast = 0;
+static int32_t gToday;        // day 0 of the forecast
+static SA_SET gFc_expire, gFc_ingest;
+
 typedef enum {
-  O_DRYRUN=1, O_FD
+  O_DRYRUN=1, O_FD, O_COMPILE, O_WORKERS, O_IO_BUDGET, O_REPORT, O_FORECAST, O_CHECKPOINT, O_RESUME, O_WATERMARK,
+  O_DELETERS, O_BACKGROUND, O_PSI_PAUSE, O_CGROUP, O_IO_MAX, O_LAT_TARGET,
+  O_UNLINK_THREADS
 } enPARAM;
 
 typedef struct tagPTIME 
@@ -50,293 +113,954 @@ time_t ptime_to_epoch(const PTIME *pt)
   return timegm(&t);  // UTC time epoch return
 }
 
-typedef struct tagRETN_CONFIG {
-  int default_days;
-  struct {
-	char company_id[LEN_COMPANY_ID];
-	int retention_days;
-  } company[NUM_COMPANY_MAX];
-  int count;
-
-} RETN_CONFIG;
-
 // json config global variable
 static RETN_CONFIG gRet_config;
 
+// ---- delete stage ----
+// The vp_run workers scan: they read the date levels and decide, with the
+// listing in hand, since the oldest-first stop needs each answer before the
+// next read. An expired directory is queued to its filesystem's deleter
+// threads and the scanner reads on while it is removed; a full queue holds
+// the scanner back. A device is finished (watermark, checkpoint) by whichever
+// side drops the last reference to it.
+
+#define DEL_QUEUE_CAP 256     // expired directories queued per filesystem
+
+typedef struct tagDEL_UNIT {
+  VP_FS *fs;
+  const VP_UNIT *unit;
+  int fd;                     // device directory, for its mtime at the end
+  WM_ENTRY *wm_out;           // NULL: no --watermark
+  WM_ENTRY stop;              // where the scanner stopped
+  unsigned refs;              // the scanner + queued directories (atomic)
+  bool unclean;               // something was left behind (atomic)
+} DEL_UNIT;
+
+typedef struct tagDEL_JOB {
+  DEL_UNIT *du;
+  int level;
+  PTIME pt;
+  char path[];                // the expired directory
+} DEL_JOB;
+
+typedef struct tagDEL_STAGE {
+  VP_POOL *pool;
+  VP_FS *fs;
+  JOB_QUEUE q;
+  RATE_CTL rc;                // unlink rate and deleter count (--latency-target)
+  pthread_t *thr;
+  int nthr;
+  int next_id;                // deleter numbers, for rc_active() (atomic)
+} DEL_STAGE;
+
+static DEL_STAGE *gDel;       // per filesystem
+
+// Per-thread traversal context. Each worker walks one device directory at a
+// time; the company -> device policy is looked up once per device, not for
+// every date directory below. nftw callbacks (--forecast) take no user
+// pointer, hence TLS.
+typedef struct tagWALK_CTX {
+  const PS_ROOTDIR *root;       // root the device directory belongs to
+  VP_FS *fs;                    // its filesystem (I/O budget)
+  const VP_UNIT *unit;          // company / device names
+  SA_TABLE *acct;               // this thread's accounting table
+  SA_TABLE *fc_expire, *fc_ingest;   // this thread's forecast histograms
+  const RETN_COMPANY *company;  // NULL: not configured, defaults apply
+  RETN_POLICY pol;              // policy of the current device subtree
+  DEL_STAGE *del;               // deleters (and rate control) of fs
+  DEL_UNIT *du;                 // the device being walked
+  WM_ENTRY stop;                // where the walk stopped (level 0: it did not)
+  bool unclean;                 // something was left behind: no watermark
+} WALK_CTX;
+
+static __thread WALK_CTX tWalk;
+
 
-// load config.json into RETN_CONFIG object
-static bool load_json_config(const char *path, RETN_CONFIG *pConfig)
+void print_usage (char* usage)
 {
-  // initial values
-  pConfig->count =0;
-  pConfig->default_days = 30;
-
-  // Open the JSON file for reading
-  FILE *fp = fopen(path, "r");
-  if (fp == NULL) {
-    printf("Error: Unable to open the file.\n");
-    return false;
+  fprintf(stderr,
+      "Usage: %s -c config.json -r ROOT [-r ROOT]... [--dry-run] [--fd N]\n"
+      "          [--workers N] [--io-budget N] [--report FILE] [--forecast DAYS]\n"
+      "          [--checkpoint FILE [--resume]] [--watermark FILE] [--deleters N]\n"
+      "          [--background] [--psi-pause PCT] [--cgroup DIR [--io-max SPEC]]\n"
+      "          [--latency-target MS] [--unlink-threads N]\n"
+      "       %s -c config.json --compile-config\n"
+      "  -c/--config  config.json path (required)\n"
+      "  -r/--root    root directory to scan (required); repeatable, glob patterns\n"
+      "               such as '/mnt/vol*/data' are expanded\n"
+      "  --dry-run    perform dry-run (default: false)\n"
+      "  --fd N       nftw max open fds per worker, --forecast (default 32)\n"
+      "  --workers N  scanner threads per filesystem (default 2)\n"
+      "  --deleters N  deleter threads per filesystem (default 2)\n"
+      "  --io-budget N  max files unlinked per second, per filesystem (default 0: unlimited)\n"
+      "  --report FILE  write bytes freed per company/device/day as JSON ('-': stdout);\n"
+      "               with --dry-run, what would be freed\n"
+      "  --forecast DAYS  remove nothing; project disk usage DAYS days ahead from the\n"
+      "               bytes that will expire and the recent daily ingest\n"
+      "  --checkpoint FILE  save progress to FILE every few seconds; removed when done\n"
+      "  --resume     continue from FILE, skipping device directories already done\n"
+      "  --watermark FILE  remember each device's oldest remaining date; devices whose\n"
+      "               oldest date is still within retention are skipped\n"
+      "  --background idle I/O priority for deleters; pause while io pressure (PSI\n"
+      "               some avg10) is above %.0f%%\n"
+      "  --psi-pause PCT  pause deletion while some avg10 of " IY_PSI_PATH " is above PCT\n"
+      "  --cgroup DIR  run in this cgroup v2 directory (created if missing)\n"
+      "  --io-max SPEC  write SPEC to DIR/io.max first, e.g. '8:16 wiops=2000'\n"
+      "  --latency-target MS  adapt the unlink rate and deleter count to keep unlink\n"
+      "               p99 at or below MS; --io-budget becomes the ceiling\n"
+      "  --unlink-threads N  split directories of %d files or more across N threads\n"
+      "               per deleter (default 1)\n"
+      "  --compile-config  write config.json" RETN_CACHE_SUFFIX " and exit; later runs\n"
+      "               map it instead of parsing the JSON while it is up to date\n",
+      usage, usage, IY_PSI_DEFAULT, PURGE_PAR_MIN);
+}
+
+
+// Parse the date part of a walker path as (ptr, len) spans, anchored at the
+// root (path_schema.h): no copy, no length limit, any root depth.
+// company_out (optional) receives the company span into path.
+// return: schema level of the path (PS_YEAR .. PS_MINUTE), -1 if malformed
+int parse_path_info (const char *path, size_t len, PTIME *ptime_out,
+    const char **company_out, size_t *company_len)
+{
+  if (!path || !ptime_out)
+    return -1;
+
+  // comp[level - 1]: PS_COMPANY, PS_DEVICE, PS_YEAR, ... PS_MINUTE
+  const char *comp[PS_NLEVEL - 1];
+  size_t comp_len[PS_NLEVEL - 1];
+  int level = ps_split(tWalk.root, path, len, comp, comp_len);
+
+  if (level < PS_YEAR)  // at least year info needed (or deeper than minute)
+    return -1;
+  
+  // fixed-width digits only; missing components are the start of the period
+  int v[DP_NCOMP];
+  if (dp_parse_date(comp + PS_YEAR - 1, comp_len + PS_YEAR - 1, level - PS_YEAR + 1, v) >= 0)
+    return -1;
+
+  PTIME *pt = ptime_out; 
+  pt->year    = v[DP_YEAR];
+  pt->month   = v[DP_MONTH];
+  pt->day     = v[DP_DAY];
+  pt->hour    = v[DP_HOUR];
+  pt->minute  = v[DP_MINUTE];
+  pt->second  = 0;
+
+  if (company_out && company_len) {
+    *company_out = comp[PS_COMPANY - 1];
+    *company_len = comp_len[PS_COMPANY - 1];
   }
 
-  // get the file size
-  if (fseek(fp, 0, SEEK_END) != 0) {
-    perror("Error seeking file"); // Prints "Error seeking file: [error description]"
-    fprintf(stderr, "Error seeking file: %s\n", strerror(errno));
-    fclose(fp);
-    return false;
+  return level;
+}
+
+
+// end of the directory at `level` which starts at pt (exclusive)
+static time_t dir_end_epoch(const PTIME *pt, int level)
+{
+  PTIME e = *pt;
+
+  switch (level) {
+    case PS_YEAR:  e.year++;   break;
+    case PS_MONTH: e.month++;  break;
+    case PS_DAY:   e.day++;    break;
+    case PS_HOUR:  e.hour++;   break;
+    default:       e.minute++; break;
   }
+  return ptime_to_epoch(&e);  // timegm normalizes overflowed fields
+}
 
-  long fileSize = ftell(fp);
-  if (fileSize == -1L) {
-    perror("Error getting file position");
-    fprintf(stderr, "Error getting file position: %s\n", strerror(errno));
-    fclose(fp);
-    return false;
+
+// purge_dir_at() pacing hook: charge the batch, let the rate controller
+// adjust the budget, then wait for budget, and for the io pressure to drop
+static void pace_unlinks(void *arg, unsigned long files)
+{
+  DEL_STAGE *ds = (DEL_STAGE *)arg;
+  long rate;
+  vp_io_charge(ds->fs, files);
+  if (rc_tick(&ds->rc, &rate))
+    vp_io_set_budget(ds->fs, rate);
+  vp_io_wait(ds->fs);
+  iy_psi_wait(&gPsi);
+}
+
+
+static void stat_add(PURGE_STAT *a, const PURGE_STAT *b)
+{
+  a->files += b->files;
+  a->dirs += b->dirs;
+  a->busy += b->busy;
+  a->errors += b->errors;
+  a->bytes += b->bytes;
+}
+
+
+// add st to the current device's entry for `day` in table t
+static void unit_charge(SA_TABLE *t, int32_t day, const PURGE_STAT *st)
+{
+  if (t == NULL || (st->files == 0 && st->dirs == 0))
+    return;
+
+  const VP_UNIT *u = tWalk.unit;
+  if (!sa_add(t, u->path + u->company_off, u->company_len,
+        u->path + u->device_off, u->device_len, day, st->bytes, st->files, st->dirs))
+    fprintf(stderr, " Warning: out of memory, %s not accounted\n", u->path);
+}
+
+
+// charge what was removed under the current device to the day of pt
+static void acct_charge(const PTIME *pt, const PURGE_STAT *st)
+{
+  PTIME d = { pt->year, pt->month, pt->day, 0, 0, 0 };
+  unit_charge(tWalk.acct, (int32_t)(ptime_to_epoch(&d) / 86400), st);
+}
+
+
+// Remove an expired directory with accounting. A year or month directory is
+// taken apart one day directory at a time, so bytes land on their own day;
+// anything in it that is not a date directory goes to its first day.
+static PURGE_RESULT purge_acct(int parent_fd, const char *name, int level,
+    const PTIME *pt, const PURGE_OPT *opt, PURGE_STAT *total)
+{
+  PURGE_STAT st = {0};
+  PURGE_RESULT res;
+
+  if (level >= PS_DAY) {
+    res = purge_dir_at(parent_fd, name, opt, &st);
+    acct_charge(pt, &st);
+    stat_add(total, &st);
+    return res;
   }
 
-  if (fseek(fp, 0, SEEK_SET) != 0) {
-    perror("Error seeking file"); // Prints "Error seeking file: [error description]"
-    fprintf(stderr, "Error seeking file: %s\n", strerror(errno));
-    fclose(fp);
-    return false;
+  int fd = openat(parent_fd, name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+  DIR *dir = (fd >= 0) ? fdopendir(fd) : NULL;
+  if (dir == NULL) {
+    if (fd >= 0)
+      close(fd);
+    return purge_dir_at(parent_fd, name, opt, total);   // reports the error
   }
 
-  // Read the entire file into a buffer
-  char *buffer = (char *) malloc(fileSize + 1);
-  if (buffer == NULL) {
-    fclose(fp);
-    return false;
+  res = PURGE_DONE;
+  struct dirent *de;
+  while ((de = readdir(dir)) != NULL) {
+    const char *n = de->d_name;
+    if (n[0] == '.' && (n[1] == '\0' || (n[1] == '.' && n[2] == '\0')))
+      continue;
+
+    PURGE_RESULT r;
+    PTIME c = *pt;
+    int v;
+    // child is a month (of a year) or a day (of a month); DT_UNKNOWN falls to
+    // purge_entry_at(), which stats it
+    if (de->d_type == DT_DIR && dp_component(level - PS_YEAR + 1, n, strlen(n), &v) &&
+        (level != PS_MONTH || v <= dp_days_in_month(pt->year, pt->month))) {
+      if (level == PS_YEAR)
+        c.month = v;
+      else
+        c.day = v;
+      r = purge_acct(dirfd(dir), n, level + 1, &c, opt, total);
+    }
+    else {
+      r = purge_entry_at(dirfd(dir), n, de->d_type, opt, &st);
+    }
+    if (r == PURGE_BUSY && res == PURGE_DONE)
+      res = PURGE_BUSY;
+    else if (r == PURGE_ERROR)
+      res = PURGE_ERROR;
   }
-  size_t num_read = fread(buffer, 1, (size_t)fileSize, fp);
-  if (num_read != (size_t)fileSize) {
-    fclose(fp);
-    free(buffer);
-    return false;
+
+  // the directory itself; on a real run it is empty by now
+  if (res == PURGE_DONE) {
+    if (opt->dry_run) {
+      struct stat sb;
+      if (fstat(dirfd(dir), &sb) == 0)
+        st.bytes += (unsigned long long)sb.st_blocks * 512;
+      st.dirs++;
+    }
+    else {
+      res = purge_dir_at(parent_fd, name, opt, &st);
+    }
   }
-  buffer[fileSize] = '\0'; // Null-terminate the string
+  closedir(dir);
 
-  // Close the file
-  fclose(fp);
+  acct_charge(pt, &st);
+  stat_add(total, &st);
+  return res;
+}
 
 
-  // Parse the JSON data
-  cJSON *obj_json= cJSON_Parse(buffer);
+// ---- sorted walk of the date levels ----
+// readdir() order is hash order on ext4/XFS. Each date level is read whole,
+// its names parsed and sorted as integers, and visited oldest first: the
+// first directory that is not fully expired ends the device, since every
+// later one is newer. A steady-state device costs O(expired + 1) reads.
 
-  // Check if parsing was successful
-  //
-  if (obj_json == NULL) {
-    const char *error_ptr = cJSON_GetErrorPtr();
-    if (error_ptr != NULL) {
-      fprintf(stderr, "Error JSON parsing, before: %s\n", error_ptr);
-    }
-    cJSON_Delete(obj_json);
-    free(buffer);
-    return false;
+#define DATE_SMALL 64     // names per level sorted without heap allocation
+
+typedef struct tagPATH_BUF {
+  char *s;
+  size_t len, cap;
+} PATH_BUF;
+
+static bool path_push(PATH_BUF *pb, const char *name, size_t n)
+{
+  if (pb->len + n + 2 > pb->cap) {
+    size_t ncap = (pb->len + n + 2) * 2;
+    char *ns = (char *)realloc(pb->s, ncap);
+    if (ns == NULL)
+      return false;
+    pb->s = ns;
+    pb->cap = ncap;
   }
+  pb->s[pb->len++] = '/';
+  memcpy(pb->s + pb->len, name, n);
+  pb->len += n;
+  pb->s[pb->len] = '\0';
+  return true;
+}
+
+static void path_pop(PATH_BUF *pb, size_t len)
+{
+  pb->len = len;
+  pb->s[len] = '\0';
+}
+
 
-  // Process the JSON data
-  cJSON *retention = cJSON_GetObjectItem(obj_json, "retention");
-  if (!retention ) { 
-    cJSON_Delete(obj_json); 
-    free(buffer);
-    return false; 
+// LSD radix sort, 8 bits a pass; values are below 10000 (years), and months,
+// days, hours and minutes need only the first pass
+static void sort_dates(uint16_t *v, uint16_t *tmp, size_t n)
+{
+  uint16_t max = 0;
+  for (size_t i = 0; i < n; i++)
+    if (v[i] > max)
+      max = v[i];
+
+  for (int shift = 0; shift < 16 && (max >> shift) != 0; shift += 8) {
+    size_t count[257] = {0};
+    for (size_t i = 0; i < n; i++)
+      count[((v[i] >> shift) & 0xFF) + 1]++;
+    for (int b = 0; b < 256; b++)
+      count[b + 1] += count[b];
+    for (size_t i = 0; i < n; i++)
+      tmp[count[(v[i] >> shift) & 0xFF]++] = v[i];
+    memcpy(v, tmp, n * sizeof(*v));
   }
+}
 
 
-  for (cJSON *iter = retention->child; iter != NULL; iter = iter->next) {
-    if (!iter->string || !cJSON_IsNumber(iter))
+// Read the date directories of one level (YYYY, MM, ...) as numbers, sorted.
+// Malformed names are reported and left alone. *out is `small` unless the
+// level holds more than DATE_SMALL names; then it must be freed.
+static size_t read_dates(DIR *dir, int level, const PTIME *pt, PATH_BUF *pb,
+    uint16_t *small, uint16_t **out)
+{
+  uint16_t *v = small;
+  size_t n = 0, cap = DATE_SMALL;
+  struct dirent *de;
+
+  while ((de = readdir(dir)) != NULL) {
+    const char *name = de->d_name;
+    if (name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0')))
       continue;
 
-    // default days parsing
-    if (strcmp(iter->string, "default")==0) {
-      pConfig->default_days = iter->valueint;
+    // files next to date directories go with their parent, as before
+    if (de->d_type == DT_UNKNOWN) {
+      struct stat sb;
+      if (fstatat(dirfd(dir), name, &sb, AT_SYMLINK_NOFOLLOW) != 0 || !S_ISDIR(sb.st_mode))
+        continue;
+    }
+    else if (de->d_type != DT_DIR) {
       continue;
     }
 
-    if (pConfig->count >= NUM_COMPANY_MAX ) {
-      fprintf(stderr, " Warning: reached to the max number of company: %d %s\n",
-          NUM_COMPANY_MAX, iter->string);
+    // never guess a date for a name like "2025x" or "abc": leave it alone
+    int val;
+    size_t len = strlen(name);
+    if (!dp_component(level - PS_YEAR, name, len, &val) ||
+        (level == PS_DAY && val > dp_days_in_month(pt->year, pt->month))) {
+      __atomic_fetch_add(&gMalformed, 1, __ATOMIC_RELAXED);
+      fprintf(stderr, " Warning: skipping malformed date directory: %s/%s\n", pb->s, name);
       continue;
     }
 
-    // parsing company id and days pair 
-    strncpy (pConfig->company[pConfig->count].company_id, iter->string, LEN_COMPANY_ID-1);
-    pConfig->company[pConfig->count].company_id[LEN_COMPANY_ID - 1] = '\0';
-    pConfig->company[pConfig->count].retention_days = iter->valueint;
-    pConfig->count++;
+    if (n == cap) {
+      uint16_t *nv = (uint16_t *)malloc(cap * 2 * sizeof(uint16_t));
+      if (nv == NULL)
+        break;    // the rest waits for the next run
+      memcpy(nv, v, n * sizeof(uint16_t));
+      if (v != small)
+        free(v);
+      v = nv;
+      cap *= 2;
+    }
+    v[n++] = (uint16_t)val;
   }
 
-
-  // Clean up
-  cJSON_Delete(obj_json);
-  free(buffer);
-  return true;
+  uint16_t tmp_small[DATE_SMALL];
+  uint16_t *tmp = (n <= DATE_SMALL) ? tmp_small : (uint16_t *)malloc(n * sizeof(uint16_t));
+  if (tmp != NULL)
+    sort_dates(v, tmp, n);
+  else
+    n = 0;    // unsorted is unsafe with the early stop
+  if (tmp != tmp_small)
+    free(tmp);
+
+  *out = v;
+  return n;
 }
 
 
+static bool walk_dates(int fd, int level, PTIME *pt, PATH_BUF *pb);
 
-void print_usage (char* usage)
+// the first directory that is not fully expired: the device's watermark
+static bool stop_at(int level, const PTIME *pt)
 {
-  fprintf(stderr,
-      "Usage: %s -c config.json -r ROOT [--dry-run] [--fd N]\n"
-      "  -c/--config  config.json path (required)\n"
-      "  -r/--root    root directory to scan (required)\n"
-      "  --dry-run    perform dry-run (default: false)\n"
-      "  --fd N       nftw max open fds (default 32)\n", usage);
+  tWalk.stop = (WM_ENTRY){ .level = level, .year = pt->year, .month = pt->month,
+    .day = pt->day, .hour = pt->hour, .minute = pt->minute };
+  return false;
 }
 
 
-int get_json_retention_days (const char* cid)
+// One date directory, `name` in parent_fd, starting at pt.
+// return: false once a directory that is not expired yet has been reached
+static bool visit_date(int parent_fd, const char *name, int level, PTIME *pt, PATH_BUF *pb)
 {
-  int retVal_days = gRet_config.default_days; //default days
-    
-  for (int i = 0; i < gRet_config.count; i++) {
-    if (strcmp(gRet_config.company[i].company_id, cid) == 0)
-      return gRet_config.company[i].retention_days;
+  const RETN_POLICY pol = tWalk.pol;
+
+  // level of the directory that is one expiry unit: month(4), day(5), hour(6), minute(7)
+  int unit_level = ps_unit_level((int)pol.granularity);
+
+  time_t dir_start = ptime_to_epoch(pt);
+  time_t newest_unit = dir_start;
+  time_t now = time(NULL);
+
+  if (level < unit_level) {
+    // oldest unit below is not expired yet: nothing below, nor anything newer
+    if (now < retn_unit_expire(dir_start, pol.granularity, pol.retention_days))
+      return stop_at(level, pt);
+    newest_unit = retn_unit_floor(dir_end_epoch(pt, level) - 60, pol.granularity);
   }
 
-  return retVal_days; 
+  if (now < retn_unit_expire(newest_unit, pol.granularity, pol.retention_days)) {
+    if (level == unit_level)
+      return stop_at(level, pt);
 
+    // partially expired year/month/day: descend to the expiry units
+    int fd = openat(parent_fd, name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+    if (fd < 0) {
+      perror(pb->s);
+      tWalk.unclean = true;
+      return true;
+    }
+    return walk_dates(fd, level + 1, pt, pb);
+  }
+
+  // whole directory expired: queue it for the deleters, waiting while the
+  // queue is full
+  DEL_JOB *job = (DEL_JOB *)malloc(sizeof(DEL_JOB) + pb->len + 1);
+  if (job == NULL) {
+    tWalk.unclean = true;
+    return true;
+  }
+  job->du = tWalk.du;
+  job->level = level;
+  job->pt = *pt;
+  memcpy(job->path, pb->s, pb->len + 1);
+  __atomic_fetch_add(&tWalk.du->refs, 1, __ATOMIC_RELAXED);
+  jq_push(&tWalk.del->q, job);
+  return true;
 }
 
 
-int parse_path_info (const char *path, PTIME *ptime_out, char* company_out, size_t size)
+// the date directories in fd (closed here), oldest first
+static bool walk_dates(int fd, int level, PTIME *pt, PATH_BUF *pb)
 {
-  if (!path || !ptime_out)
-    return -1;
+  DIR *dir = fdopendir(fd);
+  if (dir == NULL) {
+    perror(pb->s);
+    if (fd >= 0)
+      close(fd);
+    tWalk.unclean = true;
+    return true;
+  }
+
+  uint16_t small[DATE_SMALL], *v;
+  size_t n = read_dates(dir, level, pt, pb, small, &v);
+  size_t base = pb->len;
+  bool more = true;
+  PTIME saved = *pt;
+
+  for (size_t i = 0; i < n && more; i++) {
+    // validated names are fixed width, so the value gives the name back
+    char name[8];
+    int len = snprintf(name, sizeof(name), (level == PS_YEAR) ? "%04d" : "%02d", (int)v[i]);
+    switch (level) {
+      case PS_YEAR:   pt->year = v[i];   break;
+      case PS_MONTH:  pt->month = v[i];  break;
+      case PS_DAY:    pt->day = v[i];    break;
+      case PS_HOUR:   pt->hour = v[i];   break;
+      default:        pt->minute = v[i]; break;
+    }
+    if (!path_push(pb, name, (size_t)len))
+      break;
+    more = visit_date(dirfd(dir), name, level, pt, pb);
+    path_pop(pb, base);
+    *pt = saved;
+  }
 
-  char path_buffer[MAX_PATH_LEN];
-  strncpy(path_buffer, path, sizeof(path_buffer));
-  path_buffer[MAX_PATH_LEN-1] = 0;
+  if (v != small)
+    free(v);
+  closedir(dir);
+  return more;
+}
 
-  char *token[MAX_TOKEN_LEN] = {0};
-  char *saveptr=NULL;
-  const char delimiters[] = "/";
-  char *company_id = NULL;
-  char *t = strtok_r(path_buffer, delimiters, &saveptr);
 
-  int n=0;
-  // token n: 1=/data, 2=company, 3=device, 4=year, 5=month, 6=day, 7=hour, 8=minute
-  while(t != NULL) {
-    if (n == MAX_TOKEN_LEN)
-      break;
-    token[n++] = t;
-    t = strtok_r (NULL, delimiters, &saveptr);
+// --forecast: size (du-style, st_blocks) what expires within the horizon and
+// what was written in the ingest window; every other subtree is pruned unread
+static int cb_forecast_entry(const char *fpath, const struct stat *sb,
+    int typeflag, struct FTW *ftwbuf)
+{
+  (void)sb;
+
+  int level = ftwbuf->level + PS_DEVICE;
+  if (typeflag != FTW_D || level < PS_YEAR)
+    return FTW_CONTINUE;
+
+  PTIME pt = (PTIME){0};
+  size_t fpath_len = (size_t)ftwbuf->base + strlen(fpath + ftwbuf->base);
+  if (parse_path_info(fpath, fpath_len, &pt, NULL, NULL) != level) {
+    __atomic_fetch_add(&gMalformed, 1, __ATOMIC_RELAXED);
+    fprintf(stderr, " Warning: skipping malformed date directory: %s\n", fpath);
+    return FTW_SKIP_SUBTREE;
   }
 
-  if (n < 5)  // at least day, month info needed 
-    return -1;
-  
-  PTIME *p= ptime_out; 
-  company_id = token[1];
-  //device     = token[2];
-  p->year    = atoi(token[3]);
-  p->month   = atoi(token[4]);
+  const RETN_POLICY pol = tWalk.pol;
+  int unit_level = ps_unit_level((int)pol.granularity);
+  // sized per expiry unit, but never coarser than a day (ingest is per day)
+  int size_level = (unit_level > PS_DAY) ? unit_level : PS_DAY;
+
+  time_t dir_start = ptime_to_epoch(&pt);
+  time_t dir_end = dir_end_epoch(&pt, level);
+  time_t horizon = ((time_t)gToday + gForecast + 1) * 86400;    // end of the last day
+  time_t win_start = ((time_t)gToday - FC_WINDOW_DAYS) * 86400;
+  time_t win_end = (time_t)gToday * 86400;
+
+  // the oldest unit below expires first: if it is past the horizon, all are
+  time_t expire = retn_unit_expire(retn_unit_floor(dir_start, pol.granularity),
+      pol.granularity, pol.retention_days);
+  bool expiring = expire < horizon;
+  bool recent = dir_start < win_end && dir_end > win_start;
+
+  if (!expiring && !recent)
+    return FTW_SKIP_SUBTREE;
+  if (level < size_level)
+    return FTW_CONTINUE;
+
+  PURGE_OPT opt = { .dry_run = true, .count_bytes = true };
+  PURGE_STAT st = {0};
+  if (purge_dir_at(AT_FDCWD, fpath, &opt, &st) == PURGE_DONE) {
+    if (expiring)
+      unit_charge(tWalk.fc_expire, (int32_t)(expire / 86400), &st);
+    if (recent)
+      unit_charge(tWalk.fc_ingest, (int32_t)(dir_start / 86400), &st);
+  }
+  return FTW_SKIP_SUBTREE;
+}
 
-  p->day     = (n >= 6) ? atoi(token[5]): 1; // month start day: 1
-  p->hour    = (n >= 7) ? atoi(token[6]): 0;
-  p->minute  = (n >= 8) ? atoi(token[7]): 0;
-  p->second  = 0;
 
-  if (company_out && size >0) {
-    strncpy(company_out, company_id, size); 
-    company_out[size-1] = '\0';
+// Save where every root stands. Units are sorted by root, then path, and
+// everything before a filesystem's done watermark is finished: so roots
+// fully before it are done, the one holding it gets it as its cursor.
+static bool checkpoint_save(VP_POOL *pool)
+{
+  enum { R_DONE = 0, R_AT, R_TODO };
+  uint8_t *state = (uint8_t *)calloc(pool->nroot, 1);
+  const char **cursor = (const char **)calloc(pool->nroot, sizeof(char *));
+  CKPT ck;
+  ckpt_init(&ck);
+  bool ok = (state && cursor);
+
+  for (uint32_t f = 0; ok && f < pool->nfs; f++) {
+    VP_FS *fs = &pool->fs[f];
+    size_t low = vp_done_low(fs);
+    for (size_t k = low; k < fs->nunit; k++) {
+      uint32_t r = fs->unit[k].root;
+      if (k == low) {
+        state[r] = R_AT;
+        cursor[r] = fs->unit[k].path;
+      }
+      else if (state[r] == R_DONE) {
+        state[r] = R_TODO;
+      }
+    }
   }
 
-  return 0;
+  // a root of the previous run that is done, but not given this time, stays done
+  for (uint32_t i = 0; ok && i < gResume.nroot; i++) {
+    bool given = false;
+    for (uint32_t r = 0; r < pool->nroot && !given; r++)
+      given = (strcmp(gResume.root[i].path, pool->root[r].path) == 0);
+    if (!given && gResume.root[i].cursor == NULL)
+      ok = ckpt_add_root(&ck, gResume.root[i].path, NULL);
+  }
+  for (uint32_t r = 0; ok && r < pool->nroot; r++)
+    if (state[r] != R_TODO)
+      ok = ckpt_add_root(&ck, pool->root[r].path, cursor[r]);
+
+  ck.started = gCkpt_started;
+  ck.dirs = __atomic_load_n(&gDeleted_dirs, __ATOMIC_RELAXED);
+  ck.files = __atomic_load_n(&gDeleted_files, __ATOMIC_RELAXED);
+  ck.bytes = __atomic_load_n(&gDeleted_bytes, __ATOMIC_RELAXED);
+  ck.malformed = __atomic_load_n(&gMalformed, __ATOMIC_RELAXED);
+  ok = ok && ckpt_save(gCkpt_path, &ck);
+
+  ckpt_free(&ck);
+  free(state);
+  free(cursor);
+  return ok;
 }
 
 
-// Callback function to be called by nftw for each file/directory
-//
-static int cb_delete_entry(const char *fpath, const struct stat *sb,
-    int typeflag, struct FTW *ftwbuf)
+static void checkpoint_tick(VP_POOL *pool)
 {
-  // Depth: 
-  // 0=/data, 1=company, 2=device, 3=year, 4=month, 5=day, 6=hour, 7=minute
+  time_t now = time(NULL);
+  if (gCkpt_path == NULL || now - __atomic_load_n(&gCkpt_last, __ATOMIC_RELAXED) < CKPT_INTERVAL)
+    return;
+  if (pthread_mutex_trylock(&gCkpt_lock) != 0)
+    return;   // another worker is saving it
+  if (now - gCkpt_last >= CKPT_INTERVAL) {
+    checkpoint_save(pool);
+    __atomic_store_n(&gCkpt_last, now, __ATOMIC_RELAXED);
+  }
+  pthread_mutex_unlock(&gCkpt_lock);
+}
 
-  // skip under month levels (now we also consider month)
-  if (ftwbuf->level < 4) 
-    return 0;
 
-  PTIME pt = (PTIME){0}; 
-  char company_id[LEN_COMPANY_ID] = {0};
+// --resume: device directories the interrupted run had finished
+static bool resume_done(const VP_POOL *pool, const VP_UNIT *u)
+{
+  if (gResume.nroot == 0)
+    return false;
+  const CKPT_ROOT *r = ckpt_find(&gResume, pool->root[u->root].path);
+  if (r == NULL)
+    return false;   // not started
+  return r->cursor == NULL || strcmp(u->path, r->cursor) < 0;
+}
+
 
-  if (parse_path_info(fpath, &pt, company_id, (size_t)sizeof(company_id)) != 0) 
-    return 0;
+// --watermark: the device can be skipped if, as of the last run, its oldest
+// directory is known, the device directory is unchanged, that directory is
+// still there (one openat), and it is not expired yet
+static bool wm_skip(int fd, const VP_UNIT *u, WM_ENTRY *out)
+{
+  WM_ENTRY *e = wm_find(&gWm, u->path);
+  struct stat sb;
+  if (e == NULL || fstat(fd, &sb) != 0)
+    return false;
+  e->used = true;   // replaced by what this run finds
+  if ((int64_t)sb.st_mtim.tv_sec != e->mtime_sec || (int64_t)sb.st_mtim.tv_nsec != e->mtime_nsec)
+    return false;
 
-  // deletion criteria is the day, so hour.min should be zero'ed 
-  pt.hour   = 0;
-  pt.minute = 0;
-  pt.second = 0;
+  char rel[32];
+  wm_dir(e, rel, sizeof(rel));
+  int d = openat(fd, rel, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+  if (d < 0)
+    return false;
+  close(d);
 
-  time_t device_time = ptime_to_epoch(&pt);
-  time_t now=time(NULL);
-  double diff_days = difftime(now, device_time )/(60*60*24);
+  // policy of this run: config.json may have changed since
+  PTIME pt = { e->year, e->month, e->day, e->hour, e->minute, 0 };
+  const RETN_POLICY pol = tWalk.pol;
+  time_t oldest = retn_unit_floor(ptime_to_epoch(&pt), pol.granularity);
+  if (time(NULL) >= retn_unit_expire(oldest, pol.granularity, pol.retention_days))
+    return false;
 
+  *out = *e;
+  out->path = u->path;
+  return true;
+}
 
-  // obtain device's retention days from json
-  int retention_days = get_json_retention_days (company_id);
 
-  // true, if device current working days bigger than retention days
-  bool bRemove = (diff_days >= retention_days); 
+// Drop a reference to the device; the last one records its watermark and
+// marks it done for the checkpoint.
+static void unit_release(DEL_UNIT *du)
+{
+  if (__atomic_sub_fetch(&du->refs, 1, __ATOMIC_ACQ_REL) != 0)
+    return;
+
+  // the mtime after our own removals, so they do not invalidate it
+  struct stat sb;
+  if (du->wm_out && !du->unclean && du->stop.level && fstat(du->fd, &sb) == 0) {
+    *du->wm_out = du->stop;
+    du->wm_out->path = du->unit->path;
+    du->wm_out->mtime_sec = (int64_t)sb.st_mtim.tv_sec;
+    du->wm_out->mtime_nsec = (int64_t)sb.st_mtim.tv_nsec;
+  }
+  close(du->fd);
+  vp_unit_done(du->fs, du->unit);
+  free(du);
+}
 
-  switch (typeflag) {
-    // delete files inside directory
-    case FTW_F:
-    case FTW_SL:
 
-      // remove files, symbols etc
-      if (bRemove == true) {
-        if (gDry_run) // dry-run check
-          printf("[DRY-RUN] Deleted file: %s\n", fpath);
-        else {
-          if (remove(fpath)==0) {
+// deleter: remove one expired directory with all its subdirectories and
+// files, paced by this filesystem's I/O budget only
+static void delete_job(const DEL_JOB *job)
+{
+  PURGE_OPT opt = { .busy_grace = 0, .dry_run = gDry_run, .count_bytes = gAcct_on,
+    .threads = gUnlink_threads, .pace = pace_unlinks, .pace_arg = tWalk.del,
+    .latency = (gLat_target > 0) ? rc_sample : NULL, .latency_arg = &tWalk.del->rc };
+  PURGE_STAT st = {0};
+  PURGE_RESULT res;
+
+  iy_psi_wait(&gPsi);
+  tWalk.unit = job->du->unit;
+  if (gAcct_on && tWalk.acct == NULL)
+    tWalk.acct = sa_table_new(&gAcct);
+
+  vp_io_wait(tWalk.fs);
+  if (gAcct_on)
+    res = purge_acct(AT_FDCWD, job->path, job->level, &job->pt, &opt, &st);
+  else
+    res = purge_dir_at(AT_FDCWD, job->path, &opt, &st);
+
+  if (res == PURGE_BUSY || res == PURGE_ERROR)
+    __atomic_store_n(&job->du->unclean, true, __ATOMIC_RELAXED);  // the next run must see it
+
+  if (res == PURGE_DONE) {
+    __atomic_fetch_add(&gDeleted_dirs, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&gDeleted_files, st.files, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&gDeleted_bytes, st.bytes, __ATOMIC_RELAXED);
+    if (gDry_run) // dry-run check
+      printf("[DRY-RUN] Delete directory: %s (%lu files)\n", job->path, st.files);
 #ifdef _DEBUG_
-            printf("Deleted file: %s\n",fpath);
+    else
+      printf("Delete directory: %s (%lu files)\n", job->path, st.files);
 #endif
-          }
-          else
-            perror(fpath);
-        }
-      }
+  }
+}
+
+
+static void *deleter_main(void *p)
+{
+  DEL_STAGE *ds = (DEL_STAGE *)p;
+  int id = __atomic_fetch_add(&ds->next_id, 1, __ATOMIC_RELAXED);
+  void *item;
+
+  tWalk.fs = ds->fs;
+  tWalk.del = ds;
+  if (gBackground && !iy_idle_thread())
+    fprintf(stderr, " Warning: ioprio_set(IDLE): %s\n", strerror(errno));
+  for (;;) {
+    // the rate controller may have cut the deleter count below this one
+    while (id >= rc_active(&ds->rc) && !__atomic_load_n(&ds->q.closed, __ATOMIC_ACQUIRE))
+      usleep(RC_PARK_US);
+    if (!jq_pop(&ds->q, &item))
       break;
+    DEL_JOB *job = (DEL_JOB *)item;
+    checkpoint_tick(ds->pool);    // the scanners may be long gone
+    delete_job(job);
+    unit_release(job->du);
+    free(job);
+  }
+  return NULL;
+}
 
-      // if directory (post-order travel)
-    case FTW_DP: 
-      // direcotry : post-order, empty order: minute(7)->hour(6)->day(5)->month(4)
-      if (bRemove && (ftwbuf->level >= 4 && ftwbuf->level <= 7)) {
 
-        // remove directory itself
-        if (gDry_run) // dry-run check
-          printf("[DRY-RUN] Delete directory: %s\n", fpath);
+// a queue and gDeleters threads per filesystem that has devices; io_budget
+// is the rate controller's ceiling
+static bool del_start(VP_POOL *pool, long io_budget)
+{
+  gDel = (DEL_STAGE *)calloc(pool->nfs + 1, sizeof(DEL_STAGE));
+  if (gDel == NULL)
+    return false;
 
-        else {
-          if (remove(fpath)==0) {
-#ifdef _DEBUG_
-            printf("Delete directory: %s\n",fpath);
-#endif
-          }
-          else if (errno != ENOTEMPTY) // ignore error for non empty 
-            perror(fpath);
-        }
-      }
-      break;
+  for (uint32_t f = 0; f < pool->nfs; f++) {
+    DEL_STAGE *ds = &gDel[f];
+    ds->pool = pool;
+    ds->fs = &pool->fs[f];
+    rc_init(&ds->rc, f, gLat_target, io_budget, gDeleters);
+    if (pool->fs[f].nunit == 0)
+      continue;
+    if (!jq_init(&ds->q, DEL_QUEUE_CAP) ||
+        (ds->thr = (pthread_t *)calloc((size_t)gDeleters, sizeof(pthread_t))) == NULL)
+      return false;
+    for (int k = 0; k < gDeleters; k++) {
+      int err = pthread_create(&ds->thr[ds->nthr], NULL, deleter_main, ds);
+      if (err != 0)
+        fprintf(stderr, "pthread_create: %s\n", strerror(err));
+      else
+        ds->nthr++;
+    }
+    if (ds->nthr == 0)
+      return false;   // nothing would ever drain the queue
+  }
+  return true;
+}
 
-    default:
-      break;
+
+// after the scan: let the deleters drain their queues, then report on them
+static void del_stop(VP_POOL *pool)
+{
+  for (uint32_t f = 0; f < pool->nfs; f++)
+    if (gDel[f].q.cell)     // filesystems without devices have no queue
+      jq_close(&gDel[f].q);
+
+  for (uint32_t f = 0; f < pool->nfs; f++) {
+    DEL_STAGE *ds = &gDel[f];
+    for (int k = 0; k < ds->nthr; k++)
+      pthread_join(ds->thr[k], NULL);
+
+    const JQ_STAT *qs = &ds->q.stat;
+    if (qs->pushed)
+      printf("Delete queue %u: %lu directories, occupancy mean %.1f peak %zu of %zu, "
+          "scanners waited %lu times, deleters %lu\n", f, qs->pushed,
+          (double)qs->occupancy_sum / (double)qs->pushed, qs->peak, ds->q.mask + 1,
+          qs->full_waits, qs->empty_waits);
+    if (ds->rc.target_ns)
+      printf("Latency control %u: %lu increases, %lu decreases, last p99 %.3f ms, "
+          "ended at %ld files/s, %d deleters\n", f, ds->rc.ups, ds->rc.downs,
+          (double)ds->rc.p99_ns / 1e6, ds->rc.rate, ds->rc.active);
+    rc_free(&ds->rc);
+    if (ds->q.cell)
+      jq_free(&ds->q);
+    free(ds->thr);
   }
+  free(gDel);
+  gDel = NULL;
+}
 
-  return 0;
+
+// scanner: one device directory, <root>/<company>/<device>
+static bool walk_device(VP_POOL *pool, VP_FS *fs, const VP_UNIT *u, void *arg)
+{
+  (void)arg;
+
+  checkpoint_tick(pool);
+  if (resume_done(pool, u))
+    return true;
+
+  tWalk.root = &pool->root[u->root];
+  tWalk.fs = fs;
+  tWalk.unit = u;
+  if (gAcct_on && tWalk.acct == NULL)
+    tWalk.acct = sa_table_new(&gAcct);  // kept for the thread's later units
+  if (gForecast && tWalk.fc_expire == NULL) {
+    tWalk.fc_expire = sa_table_new(&gFc_expire);
+    tWalk.fc_ingest = sa_table_new(&gFc_ingest);
+  }
+  tWalk.company = retn_find_company(&gRet_config, u->path + u->company_off, u->company_len);
+  tWalk.pol = retn_device_policy(&gRet_config, tWalk.company,
+      u->path + u->device_off, u->device_len);
+
+  if (gForecast) {
+    // FTW_PHYS: Do not follow symbolic links || FTW_ACTIONRETVAL: prune subtrees
+    if (nftw(u->path, cb_forecast_entry, gFd_value, FTW_PHYS | FTW_ACTIONRETVAL) == -1)
+      perror(u->path);
+    return true;
+  }
+
+  // expired directories are removed as a whole by the deleters
+  int fd = open(u->path, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+  if (fd < 0) {
+    perror(u->path);
+    return true;
+  }
+  size_t plen = strlen(u->path);
+  PATH_BUF pb = { strdup(u->path), plen, plen + 1 };
+  DEL_UNIT *du = (DEL_UNIT *)calloc(1, sizeof(DEL_UNIT));
+  if (pb.s == NULL || du == NULL) {
+    free(pb.s);
+    free(du);
+    close(fd);
+    return true;
+  }
+
+  WM_ENTRY *wm_out = gWm_out ? &gWm_out[fs - pool->fs][u - fs->unit] : NULL;
+  if (wm_out && wm_skip(fd, u, wm_out)) {
+    __atomic_fetch_add(&gWm_skipped, 1, __ATOMIC_RELAXED);
+    free(pb.s);
+    free(du);
+    close(fd);
+    return true;
+  }
+
+  *du = (DEL_UNIT){ .fs = fs, .unit = u, .fd = fd, .wm_out = wm_out, .refs = 1 };
+  tWalk.del = &gDel[fs - pool->fs];
+  tWalk.du = du;
+  tWalk.stop.level = 0;
+  tWalk.unclean = false;
+  PTIME pt = { DP_YEAR_MIN, 1, 1, 0, 0, 0 };
+  walk_dates(dup(fd), PS_YEAR, &pt, &pb);
+  free(pb.s);
+
+  // deleters may still be at work on it: the last one out finishes the device
+  du->stop = tWalk.stop;
+  if (tWalk.unclean)
+    __atomic_store_n(&du->unclean, true, __ATOMIC_RELAXED);
+  unit_release(du);
+  return false;
+}
+
+
+// keep the entries of this run, and the old ones of devices it listed but
+// did not get to; entries of devices no longer under the roots are dropped
+static void wm_write(VP_POOL *pool)
+{
+  size_t total = 0;
+  for (uint32_t f = 0; f < pool->nfs; f++)
+    total += pool->fs[f].nunit;
+
+  const WM_ENTRY **list = (const WM_ENTRY **)malloc((total + 1) * sizeof(WM_ENTRY *));
+  if (list == NULL)
+    return;
+  size_t n = 0, listed = 0;
+  for (uint32_t f = 0; f < pool->nfs; f++) {
+    for (size_t k = 0; k < pool->fs[f].nunit; k++) {
+      const WM_ENTRY *old = wm_find(&gWm, pool->fs[f].unit[k].path);
+      listed += (old != NULL);
+      if (gWm_out[f][k].path)
+        list[n++] = &gWm_out[f][k];
+      else if (old && !old->used)
+        list[n++] = old;
+    }
+  }
+
+  if (wm_save(gWm_path, list, n))
+    printf("Watermark: %lu devices skipped, %zu saved to %s, %zu gone devices dropped\n",
+        gWm_skipped, n, gWm_path, gWm.count - listed);
+  free(list);
 }
 
 
+// statvfs of one pool filesystem, through any of its units or roots
+static bool fs_statvfs(const VP_POOL *pool, const VP_FS *fs, struct statvfs *vs)
+{
+  if (fs->nunit > 0)
+    return statvfs(fs->unit[0].path, vs) == 0;
+  for (uint32_t r = 0; r < pool->nroot; r++) {
+    struct stat rs;
+    if (stat(pool->root[r].path, &rs) == 0 && rs.st_dev == fs->dev)
+      return statvfs(pool->root[r].path, vs) == 0;
+  }
+  return false;
+}
+
 
 int main(int argc, char **argv) {
   int c;
   const char *config_path = NULL;
-  const char *root_path = NULL;
-  int fd_value= 32;  //default
+  VP_POOL pool;
+  bool root_given = false;
+  int workers = 2;      // per filesystem
+  long io_budget = 0;   // files/sec per filesystem, 0 = unlimited
+  bool compile_config = false;
+  const char *report_path = NULL;
+  bool resume = false;
+  double psi_pause = -1;   // -1: default of the mode
+  const char *cgroup = NULL, *io_max = NULL;
+
+  vp_init(&pool);
 
   typedef struct option longoption_t;
 
@@ -345,6 +1069,21 @@ int main(int argc, char **argv) {
     { "root",     required_argument, NULL, 'r'},
     { "dry-run",  no_argument,       NULL, O_DRYRUN},
     { "fd",       required_argument, NULL, O_FD    },
+    { "compile-config", no_argument, NULL, O_COMPILE },
+    { "workers",  required_argument, NULL, O_WORKERS },
+    { "io-budget", required_argument, NULL, O_IO_BUDGET },
+    { "report",   required_argument, NULL, O_REPORT },
+    { "forecast", required_argument, NULL, O_FORECAST },
+    { "checkpoint", required_argument, NULL, O_CHECKPOINT },
+    { "resume",   no_argument,       NULL, O_RESUME },
+    { "watermark", required_argument, NULL, O_WATERMARK },
+    { "deleters", required_argument, NULL, O_DELETERS },
+    { "background", no_argument,     NULL, O_BACKGROUND },
+    { "psi-pause", required_argument, NULL, O_PSI_PAUSE },
+    { "cgroup",   required_argument, NULL, O_CGROUP },
+    { "io-max",   required_argument, NULL, O_IO_MAX },
+    { "latency-target", required_argument, NULL, O_LAT_TARGET },
+    { "unlink-threads", required_argument, NULL, O_UNLINK_THREADS },
     { NULL, 0, NULL, 0 }
   };
 
@@ -356,16 +1095,73 @@ int main(int argc, char **argv) {
         printf("config_path :%s\n", config_path );
         break;        
       case 'r':       
-        root_path = optarg;
-        printf("root_path:%s\n", root_path);
+        root_given = true;
+        vp_add_roots(&pool, optarg);
+        printf("root_path:%s\n", optarg);
         break;        
       case O_DRYRUN:       
         gDry_run = true;
         printf("dry-run:%d\n", gDry_run);
         break;
       case O_FD:       
-        fd_value = atoi(optarg);
-        printf("fd :%d\n", fd_value);
+        gFd_value = atoi(optarg);
+        printf("fd :%d\n", gFd_value);
+        break;
+      case O_WORKERS:
+        workers = atoi(optarg);
+        break;
+      case O_DELETERS:
+        gDeleters = atoi(optarg);
+        if (gDeleters < 1)
+          gDeleters = 1;
+        break;
+      case O_BACKGROUND:
+        gBackground = true;
+        break;
+      case O_PSI_PAUSE:
+        psi_pause = atof(optarg);
+        break;
+      case O_CGROUP:
+        cgroup = optarg;
+        break;
+      case O_IO_MAX:
+        io_max = optarg;
+        break;
+      case O_UNLINK_THREADS:
+        gUnlink_threads = atoi(optarg);
+        if (gUnlink_threads < 1 || gUnlink_threads > PURGE_PAR_MAX) {
+          fprintf(stderr, "Error: --unlink-threads N must be 1..%d\n", PURGE_PAR_MAX);
+          exit(EXIT_FAILURE);
+        }
+        break;
+      case O_LAT_TARGET:
+        gLat_target = atof(optarg);
+        break;
+      case O_IO_BUDGET:
+        io_budget = atol(optarg);
+        break;
+      case O_REPORT:
+        report_path = optarg;
+        break;
+      case O_FORECAST:
+        gForecast = atoi(optarg);
+        if (gForecast < 1 || gForecast > 3650) {
+          fprintf(stderr, "Error: --forecast DAYS must be 1..3650\n");
+          exit(EXIT_FAILURE);
+        }
+        gDry_run = true;    // never removes anything
+        break;
+      case O_CHECKPOINT:
+        gCkpt_path = optarg;
+        break;
+      case O_RESUME:
+        resume = true;
+        break;
+      case O_WATERMARK:
+        gWm_path = optarg;
+        break;
+      case O_COMPILE:
+        compile_config = true;
         break;
       case 'V':
         //use_stderr = opt_stderr = 1;
@@ -378,27 +1174,181 @@ int main(int argc, char **argv) {
   }
 
 
-  if (!config_path || !root_path) { 
+  if (compile_config && config_path) {
+    char cache_path[PATH_MAX];
+    snprintf(cache_path, sizeof(cache_path), "%s%s", config_path, RETN_CACHE_SUFFIX);
+    if (!retn_compile_config(config_path, cache_path))
+      return EXIT_FAILURE;
+    printf("Compiled %s -> %s\n", config_path, cache_path);
+    return 0;
+  }
+
+  if (!config_path || !root_given) { 
     print_usage(argv[0]); 
     return EXIT_FAILURE; 
   }
-
-  printf("Config path: %s\nRoot path: %s\nDry-Run: %s\nFD size: %d\n",
-      config_path, root_path, gDry_run ?"true":"false", fd_value);
-
-
-  if (!load_json_config(config_path, &gRet_config))
+  if (pool.nroot == 0) {
+    fprintf(stderr, "Error: no usable root directory\n");
+    return EXIT_FAILURE;
+  }
+  if (resume && !gCkpt_path) {
+    fprintf(stderr, "Error: --resume needs --checkpoint FILE\n");
+    return EXIT_FAILURE;
+  }
+  if (io_max && !cgroup) {
+    fprintf(stderr, "Error: --io-max needs --cgroup DIR\n");
+    return EXIT_FAILURE;
+  }
+  if (gForecast)
+    gCkpt_path = NULL;    // nothing to resume: it removes nothing
+
+  // before any thread starts; yielding is best effort, a failure is not fatal
+  if (cgroup && iy_join_cgroup(cgroup, io_max))
+    printf("Cgroup: %s%s%s\n", cgroup, io_max ? ", io.max " : "", io_max ? io_max : "");
+  if (psi_pause < 0)
+    psi_pause = gBackground ? IY_PSI_DEFAULT : 0;
+  if (!iy_psi_init(&gPsi, IY_PSI_PATH, gForecast ? 0 : psi_pause))
+    fprintf(stderr, " Warning: %s unreadable (no PSI support?), not watching io pressure\n",
+        IY_PSI_PATH);
+  else if (gPsi.limit > 0)
+    printf("Pausing deletion while io pressure is above %.2f%%\n", gPsi.limit);
+
+  printf("Config path: %s\nRoots: %u on %u filesystems\nDry-Run: %s\nFD size: %d\n"
+      "Workers: %d scanners, %d deleters per filesystem\n",
+      config_path, pool.nroot, pool.nfs, gDry_run ?"true":"false", gFd_value, workers,
+      gForecast ? 0 : gDeleters);
+
+
+  if (!retn_load_config(config_path, &gRet_config))
     return EXIT_FAILURE;
 
+  printf("Config: %u companies, %s in %.3f ms, %zu bytes\n",
+      gRet_config.count, gRet_config.map ? "mapped from cache" : "parsed",
+      gRet_config.parse_ms, retn_config_mem(&gRet_config));
+
+
+  gAcct_on = (report_path != NULL && !gForecast);
+  sa_init(&gAcct);
+  sa_init(&gFc_expire);
+  sa_init(&gFc_ingest);
+  gToday = (int32_t)(time(NULL) / 86400);
+
+  gCkpt_started = gCkpt_last = time(NULL);
+  ckpt_init(&gResume);
+  if (resume) {
+    if (ckpt_load(gCkpt_path, &gResume)) {
+      gCkpt_started = gResume.started;
+      gDeleted_dirs = gResume.dirs;
+      gDeleted_files = gResume.files;
+      gDeleted_bytes = gResume.bytes;
+      gMalformed = gResume.malformed;
+      printf("Resuming from %s: %u roots recorded, %lu directories removed so far\n",
+          gCkpt_path, gResume.nroot, gResume.dirs);
+    }
+    else {
+      printf(" Notice: no checkpoint in %s, starting from the beginning\n", gCkpt_path);
+    }
+  }
 
-  // FTW_PHYS: Do not follow symbolic links || FTW_DEPTH: ensures children are processed before parent 
-  int flags = FTW_PHYS | FTW_DEPTH; 
+  // work units are device directories, listed per filesystem; then every
+  // filesystem runs its own worker pool, all in this one process
+  if (!vp_scan_units(&pool)) {
+    fprintf(stderr, "Error: out of memory listing device directories\n");
+    return EXIT_FAILURE;
+  }
 
-  if (nftw(root_path, cb_delete_entry, fd_value, flags) == -1) {
-    perror("nftw");
+  wm_init(&gWm);
+  if (gWm_path && !gForecast) {
+    if (!wm_load(gWm_path, &gWm))
+      printf(" Notice: no watermark cache in %s, walking every device\n", gWm_path);
+    gWm_out = (WM_ENTRY **)calloc(pool.nfs + 1, sizeof(WM_ENTRY *));
+    for (uint32_t f = 0; gWm_out && f < pool.nfs; f++)
+      if ((gWm_out[f] = (WM_ENTRY *)calloc(pool.fs[f].nunit + 1, sizeof(WM_ENTRY))) == NULL) {
+        fprintf(stderr, "Error: out of memory for the watermark cache\n");
+        return EXIT_FAILURE;
+      }
+  }
+  if (!gForecast && !del_start(&pool, io_budget)) {
+    fprintf(stderr, "Error: unable to start deleters\n");
     return EXIT_FAILURE;
   }
+  // under rate control, every filesystem starts at the controller's rate
+  if (gDel && gDel[0].rc.target_ns)
+    io_budget = gDel[0].rc.rate;
+  if (!vp_run(&pool, workers, io_budget, walk_device, NULL)) {
+    fprintf(stderr, "Error: unable to start workers\n");
+    return EXIT_FAILURE;
+  }
+  if (gDel)
+    del_stop(&pool);
+
+  // the pass is complete: a later --resume starts over
+  if (gCkpt_path && unlink(gCkpt_path) != 0 && errno != ENOENT)
+    perror(gCkpt_path);
+  ckpt_free(&gResume);
+
+  // a dry run removed nothing, so its stop points are not the device's oldest data
+  if (gWm_out) {
+    if (!gDry_run)
+      wm_write(&pool);
+    for (uint32_t f = 0; f < pool.nfs; f++)
+      free(gWm_out[f]);
+    free(gWm_out);
+  }
+  wm_free(&gWm);
+
+  if (!gForecast)
+    printf("%s %lu expired directories, %lu files\n", gDry_run ? "Would remove" : "Removed",
+        gDeleted_dirs, gDeleted_files);
+  if (gMalformed)
+    printf("Skipped %lu malformed date directories\n", gMalformed);
+  if (gPsi.pauses)
+    printf("Paused %lu times for io pressure, %.1f s in all\n", gPsi.pauses, gPsi.paused_sec);
+  iy_psi_free(&gPsi);
+
+  if (gForecast) {
+    // usage now: the filesystems themselves, not a du of the tree
+    FC_PARAM fp = { gToday, gForecast, FC_WINDOW_DAYS, 0, 0, 0 };
+    for (uint32_t f = 0; f < pool.nfs; f++) {
+      struct statvfs vs;
+      if (!fs_statvfs(&pool, &pool.fs[f], &vs))
+        continue;
+      fp.nfs++;
+      fp.used += (uint64_t)(vs.f_blocks - vs.f_bfree) * vs.f_frsize;
+      fp.size += (uint64_t)vs.f_blocks * vs.f_frsize;
+    }
+
+    bool to_stdout = report_path && strcmp(report_path, "-") == 0;
+    FILE *json = !report_path ? NULL : to_stdout ? stdout : fopen(report_path, "w");
+    if (report_path && json == NULL)
+      perror(report_path);
+    if (!fc_report(&gFc_expire, &gFc_ingest, &fp, stdout, json))
+      fprintf(stderr, "Error: unable to write forecast\n");
+    if (json && !to_stdout)
+      fclose(json);
+  }
+  sa_free(&gFc_expire);
+  sa_free(&gFc_ingest);
+
+  if (gAcct_on) {
+    bool to_stdout = (strcmp(report_path, "-") == 0);
+    FILE *out = to_stdout ? stdout : fopen(report_path, "w");
+    SA_ENTRY total = {0};
+    if (out == NULL)
+      perror(report_path);
+    else if (!sa_report(&gAcct, out, gDry_run, &total))
+      fprintf(stderr, "Error: unable to write report %s\n", report_path);
+    else
+      printf("%s %llu bytes in %llu files, %llu directories\n",
+          gDry_run ? "Would free" : "Freed", (unsigned long long)total.bytes,
+          (unsigned long long)total.files, (unsigned long long)total.dirs);
+    if (out && !to_stdout)
+      fclose(out);
+  }
+  sa_free(&gAcct);
 
+  vp_free(&pool);
+  retn_config_free(&gRet_config);
 
   return 0;
 }
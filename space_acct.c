@@ -0,0 +1,287 @@
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "space_acct.h"
+
+void sa_init(SA_SET *set)
+{
+  memset(set, 0, sizeof(*set));
+  pthread_mutex_init(&set->lock, NULL);
+}
+
+
+void sa_table_free(SA_TABLE *t)
+{
+  for (size_t i = 0; i < t->nslot; i++)
+    free(t->slot[i].company);
+  free(t->slot);
+  memset(t, 0, sizeof(*t));
+}
+
+
+void sa_free(SA_SET *set)
+{
+  for (uint32_t i = 0; i < set->ntable; i++) {
+    sa_table_free(set->table[i]);
+    free(set->table[i]);
+  }
+  free(set->table);
+  pthread_mutex_destroy(&set->lock);
+  memset(set, 0, sizeof(*set));
+}
+
+
+SA_TABLE *sa_table_new(SA_SET *set)
+{
+  SA_TABLE *t = (SA_TABLE *)calloc(1, sizeof(SA_TABLE));
+  if (t == NULL)
+    return NULL;
+
+  pthread_mutex_lock(&set->lock);
+  if (set->ntable == set->cap) {
+    uint32_t ncap = set->cap ? set->cap * 2 : 16;
+    SA_TABLE **nt = (SA_TABLE **)realloc(set->table, ncap * sizeof(SA_TABLE *));
+    if (nt == NULL) {
+      pthread_mutex_unlock(&set->lock);
+      free(t);
+      return NULL;
+    }
+    set->table = nt;
+    set->cap = ncap;
+  }
+  set->table[set->ntable++] = t;
+  pthread_mutex_unlock(&set->lock);
+  return t;
+}
+
+
+static uint32_t key_hash(const char *company, size_t clen,
+    const char *device, size_t dlen, int32_t day)
+{
+  uint32_t h = 2166136261u;   // FNV-1a
+  for (size_t i = 0; i < clen; i++)
+    h = (h ^ (unsigned char)company[i]) * 16777619u;
+  h = (h ^ '/') * 16777619u;
+  for (size_t i = 0; i < dlen; i++)
+    h = (h ^ (unsigned char)device[i]) * 16777619u;
+  return (h ^ (uint32_t)day) * 16777619u;
+}
+
+
+static bool grow(SA_TABLE *t)
+{
+  size_t ncap = t->nslot ? t->nslot * 2 : 64;
+  SA_ENTRY *ns = (SA_ENTRY *)calloc(ncap, sizeof(SA_ENTRY));
+  if (ns == NULL)
+    return false;
+
+  for (size_t i = 0; i < t->nslot; i++) {
+    if (t->slot[i].company == NULL)
+      continue;
+    size_t k = t->slot[i].hash & (ncap - 1);
+    while (ns[k].company)
+      k = (k + 1) & (ncap - 1);
+    ns[k] = t->slot[i];
+  }
+  free(t->slot);
+  t->slot = ns;
+  t->nslot = ncap;
+  return true;
+}
+
+
+bool sa_add(SA_TABLE *t, const char *company, size_t clen,
+    const char *device, size_t dlen, int32_t day,
+    uint64_t bytes, uint64_t files, uint64_t dirs)
+{
+  // keep the load factor under 1/2
+  if ((t->count + 1) * 2 > t->nslot && !grow(t))
+    return false;
+
+  uint32_t h = key_hash(company, clen, device, dlen, day);
+  size_t mask = t->nslot - 1;
+  size_t i = h & mask;
+
+  for (; t->slot[i].company; i = (i + 1) & mask) {
+    SA_ENTRY *e = &t->slot[i];
+    if (e->hash == h && e->day == day &&
+        strlen(e->company) == clen && memcmp(e->company, company, clen) == 0 &&
+        strlen(e->device) == dlen && memcmp(e->device, device, dlen) == 0) {
+      e->bytes += bytes;
+      e->files += files;
+      e->dirs += dirs;
+      return true;
+    }
+  }
+
+  char *name = (char *)malloc(clen + dlen + 2);
+  if (name == NULL)
+    return false;
+  memcpy(name, company, clen);
+  name[clen] = '\0';
+  memcpy(name + clen + 1, device, dlen);
+  name[clen + 1 + dlen] = '\0';
+
+  t->slot[i] = (SA_ENTRY){ name, name + clen + 1, day, h, bytes, files, dirs };
+  t->count++;
+  return true;
+}
+
+
+// ---- report ----
+
+// ids are digit strings: shorter first gives numeric order
+int sa_name_cmp(const char *a, const char *b)
+{
+  size_t la = strlen(a), lb = strlen(b);
+  if (la != lb)
+    return (la < lb) ? -1 : 1;
+  return strcmp(a, b);
+}
+
+static int entry_cmp(const void *pa, const void *pb)
+{
+  const SA_ENTRY *a = *(const SA_ENTRY *const *)pa;
+  const SA_ENTRY *b = *(const SA_ENTRY *const *)pb;
+  int r = sa_name_cmp(a->company, b->company);
+  if (r == 0)
+    r = sa_name_cmp(a->device, b->device);
+  if (r == 0)
+    r = (a->day > b->day) - (a->day < b->day);
+  return r;
+}
+
+
+// directory names go into the report as JSON strings
+void sa_put_string(FILE *out, const char *s)
+{
+  fputc('"', out);
+  for (; *s; s++) {
+    unsigned char ch = (unsigned char)*s;
+    if (ch == '"' || ch == '\\')
+      fprintf(out, "\\%c", ch);
+    else if (ch < 0x20)
+      fprintf(out, "\\u%04x", ch);
+    else
+      fputc(ch, out);
+  }
+  fputc('"', out);
+}
+
+void sa_put_day(FILE *out, int32_t day)
+{
+  time_t t = (time_t)day * 86400;
+  struct tm tm;
+  gmtime_r(&t, &tm);
+  fprintf(out, "\"%04d-%02d-%02d\"", tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday);
+}
+
+static void put_sums(FILE *out, uint64_t bytes, uint64_t files, uint64_t dirs)
+{
+  fprintf(out, "\"bytes\": %llu, \"files\": %llu, \"dirs\": %llu",
+      (unsigned long long)bytes, (unsigned long long)files, (unsigned long long)dirs);
+}
+
+
+bool sa_merge(SA_SET *set, SA_TABLE *all)
+{
+  // one company/device may live under several roots (and so on several
+  // threads), so entries are added up, not concatenated
+  for (uint32_t i = 0; i < set->ntable; i++) {
+    const SA_TABLE *t = set->table[i];
+    for (size_t k = 0; k < t->nslot; k++) {
+      const SA_ENTRY *e = &t->slot[k];
+      if (e->company && !sa_add(all, e->company, strlen(e->company),
+            e->device, strlen(e->device), e->day, e->bytes, e->files, e->dirs))
+        return false;
+    }
+  }
+  return true;
+}
+
+
+const SA_ENTRY **sa_sorted(const SA_TABLE *t, size_t *n)
+{
+  const SA_ENTRY **ent = (const SA_ENTRY **)malloc((t->count + 1) * sizeof(SA_ENTRY *));
+  if (ent == NULL)
+    return NULL;
+  *n = 0;
+  for (size_t k = 0; k < t->nslot; k++)
+    if (t->slot[k].company)
+      ent[(*n)++] = &t->slot[k];
+  qsort(ent, *n, sizeof(*ent), entry_cmp);
+  return ent;
+}
+
+
+bool sa_report(SA_SET *set, FILE *out, bool dry_run, SA_ENTRY *total)
+{
+  SA_TABLE all = {0};
+  size_t n = 0;
+  const SA_ENTRY **ent = NULL;
+  if (!sa_merge(set, &all) || (ent = sa_sorted(&all, &n)) == NULL) {
+    sa_table_free(&all);
+    return false;
+  }
+
+  SA_ENTRY sum = {0};
+  for (size_t k = 0; k < n; k++) {
+    sum.bytes += ent[k]->bytes;
+    sum.files += ent[k]->files;
+    sum.dirs += ent[k]->dirs;
+  }
+
+  fprintf(out, "{\n  \"dry_run\": %s,\n  \"total\": { ", dry_run ? "true" : "false");
+  put_sums(out, sum.bytes, sum.files, sum.dirs);
+  fprintf(out, " },\n  \"companies\": {");
+
+  // entries are sorted, so each company and each device is one run
+  for (size_t c = 0; c < n; ) {
+    size_t c_end = c;
+    uint64_t cb = 0, cf = 0, cd = 0;
+    for (; c_end < n && strcmp(ent[c_end]->company, ent[c]->company) == 0; c_end++) {
+      cb += ent[c_end]->bytes;
+      cf += ent[c_end]->files;
+      cd += ent[c_end]->dirs;
+    }
+
+    fprintf(out, "%s\n    ", c ? "," : "");
+    sa_put_string(out, ent[c]->company);
+    fprintf(out, ": { ");
+    put_sums(out, cb, cf, cd);
+    fprintf(out, ",\n      \"devices\": {");
+
+    for (size_t d = c; d < c_end; ) {
+      size_t d_end = d;
+      uint64_t db = 0, df = 0, dd = 0;
+      for (; d_end < c_end && strcmp(ent[d_end]->device, ent[d]->device) == 0; d_end++) {
+        db += ent[d_end]->bytes;
+        df += ent[d_end]->files;
+        dd += ent[d_end]->dirs;
+      }
+
+      fprintf(out, "%s\n        ", d > c ? "," : "");
+      sa_put_string(out, ent[d]->device);
+      fprintf(out, ": { ");
+      put_sums(out, db, df, dd);
+      fprintf(out, ",\n          \"days\": {");
+      for (size_t k = d; k < d_end; k++) {
+        fprintf(out, "%s ", k > d ? "," : "");
+        sa_put_day(out, ent[k]->day);
+        fprintf(out, ": %llu", (unsigned long long)ent[k]->bytes);
+      }
+      fprintf(out, " } }");
+      d = d_end;
+    }
+    fprintf(out, "\n      } }");
+    c = c_end;
+  }
+  fprintf(out, "%s}\n}\n", n ? "\n  " : " ");
+
+  if (total)
+    *total = sum;
+  free(ent);
+  sa_table_free(&all);
+  return !ferror(out);
+}
@@ -0,0 +1,62 @@
+#ifndef __SPACE_ACCT_H__
+#define __SPACE_ACCT_H__
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+// Space-freed accounting.
+// Every worker thread adds what it removed (or would remove, on a dry run)
+// to a table of its own, keyed by company, device and day, without locking.
+// The tables are merged once the workers are done and written out as JSON.
+
+typedef struct tagSA_ENTRY {
+  char *company;          // "company\0device\0" in one allocation; NULL: empty slot
+  char *device;           // points into company
+  int32_t day;            // days since 1970-01-01 (UTC)
+  uint32_t hash;
+  uint64_t bytes;         // st_blocks * 512: space actually given back
+  uint64_t files, dirs;
+} SA_ENTRY;
+
+typedef struct tagSA_TABLE {
+  SA_ENTRY *slot;         // open addressing
+  size_t nslot, count;    // nslot: power of two
+} SA_TABLE;
+
+typedef struct tagSA_SET {
+  pthread_mutex_t lock;   // guards registration of tables only
+  SA_TABLE **table;
+  uint32_t ntable, cap;
+} SA_SET;
+
+void sa_init(SA_SET *set);
+void sa_free(SA_SET *set);
+
+// a new per-thread table, owned by the set
+SA_TABLE *sa_table_new(SA_SET *set);
+
+bool sa_add(SA_TABLE *t, const char *company, size_t clen,
+    const char *device, size_t dlen, int32_t day,
+    uint64_t bytes, uint64_t files, uint64_t dirs);
+
+void sa_table_free(SA_TABLE *t);
+
+// add every table of the set into `all` (zeroed, or holding earlier merges)
+bool sa_merge(SA_SET *set, SA_TABLE *all);
+
+// entries of t sorted by company, device and day (ids in numeric order);
+// free() the array, the entries stay in t
+const SA_ENTRY **sa_sorted(const SA_TABLE *t, size_t *n);
+
+// merge every table and write the report; *total (optional) gets the sums
+bool sa_report(SA_SET *set, FILE *out, bool dry_run, SA_ENTRY *total);
+
+// report helpers
+int sa_name_cmp(const char *a, const char *b);
+void sa_put_string(FILE *out, const char *s);   // JSON string
+void sa_put_day(FILE *out, int32_t day);        // "YYYY-MM-DD"
+
+#endif //__SPACE_ACCT_H__
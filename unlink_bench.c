@@ -0,0 +1,93 @@
+// unlink_bench.c
+// Unlinks per second in one large directory, serial vs. split across threads
+// (dir_purge.c, PURGE_OPT.threads)
+//
+// Build:
+//   gcc -O2 -Wall -pthread -o unlink_bench unlink_bench.c dir_purge.c
+// Usage:
+//   ./unlink_bench DIR [FILES [THREADS ...]]   (default: 100000 files, 1 2 4 8 threads)
+//
+// For every thread count, DIR/unlink_bench.d is filled with FILES empty files
+// and synced; only its removal is timed. Run it on the filesystem in question.
+
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "dir_purge.h"
+
+static double now_sec(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+
+static int fill(const char *dir, long files)
+{
+  if (mkdir(dir, 0755) != 0) {
+    perror(dir);
+    return -1;
+  }
+  int dfd = open(dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (dfd < 0) {
+    perror(dir);
+    return -1;
+  }
+  for (long i = 0; i < files; i++) {
+    char name[32];
+    snprintf(name, sizeof(name), "f%08ld.dat", i);
+    int fd = openat(dfd, name, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+    if (fd < 0) {
+      perror(name);
+      close(dfd);
+      return -1;
+    }
+    close(fd);
+  }
+  close(dfd);
+  sync();   // the timed part should not pay for creating them
+  return 0;
+}
+
+
+int main(int argc, char **argv)
+{
+  if (argc < 2) {
+    fprintf(stderr, "Usage: %s DIR [FILES [THREADS ...]]\n", argv[0]);
+    return 1;
+  }
+
+  char dir[PATH_MAX];
+  snprintf(dir, sizeof(dir), "%s/unlink_bench.d", argv[1]);
+  long files = (argc > 2) ? atol(argv[2]) : 100000;
+
+  int def[] = { 1, 2, 4, 8 };
+  int nt = (argc > 3) ? argc - 3 : 4;
+
+  printf("%ld files in %s\n", files, dir);
+  for (int k = 0; k < nt; k++) {
+    int threads = (argc > 3) ? atoi(argv[3 + k]) : def[k];
+    if (fill(dir, files) != 0)
+      return 1;
+
+    PURGE_OPT opt = { .threads = threads };
+    PURGE_STAT st = {0};
+    double t0 = now_sec();
+    PURGE_RESULT r = purge_dir_at(AT_FDCWD, dir, &opt, &st);
+    double dt = now_sec() - t0;
+    if (r != PURGE_DONE) {
+      fprintf(stderr, "purge of %s failed (%d)\n", dir, (int)r);
+      return 1;
+    }
+    printf("threads %2d: %8.3f s  %10.0f unlinks/s\n", threads, dt, (double)st.files / dt);
+  }
+  return 0;
+}
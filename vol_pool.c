@@ -0,0 +1,380 @@
+#define _GNU_SOURCE
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <glob.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "vol_pool.h"
+
+void vp_init(VP_POOL *pool)
+{
+  memset(pool, 0, sizeof(*pool));
+}
+
+
+void vp_free(VP_POOL *pool)
+{
+  for (uint32_t i = 0; i < pool->nfs; i++) {
+    VP_FS *fs = &pool->fs[i];
+    for (size_t k = 0; k < fs->nunit; k++)
+      free(fs->unit[k].path);
+    free(fs->unit);
+    free(fs->done);
+    pthread_mutex_destroy(&fs->lock);
+  }
+  for (uint32_t i = 0; i < pool->nroot; i++)
+    free((char *)pool->root[i].path);
+  free(pool->fs);
+  free(pool->root);
+  memset(pool, 0, sizeof(*pool));
+}
+
+
+static VP_FS *fs_of(VP_POOL *pool, dev_t dev)
+{
+  for (uint32_t i = 0; i < pool->nfs; i++)
+    if (pool->fs[i].dev == dev)
+      return &pool->fs[i];
+
+  if (pool->nfs == pool->fs_cap) {
+    uint32_t ncap = pool->fs_cap ? pool->fs_cap * 2 : 8;
+    VP_FS *nf = (VP_FS *)realloc(pool->fs, ncap * sizeof(VP_FS));
+    if (nf == NULL)
+      return NULL;
+    pool->fs = nf;
+    pool->fs_cap = ncap;
+  }
+  VP_FS *fs = &pool->fs[pool->nfs++];
+  memset(fs, 0, sizeof(*fs));
+  fs->dev = dev;
+  pthread_mutex_init(&fs->lock, NULL);
+  return fs;
+}
+
+
+static bool add_root(VP_POOL *pool, const char *path)
+{
+  struct stat sb;
+  if (stat(path, &sb) != 0) {
+    fprintf(stderr, " Warning: skipping root %s: %s\n", path, strerror(errno));
+    return false;
+  }
+  if (!S_ISDIR(sb.st_mode)) {
+    fprintf(stderr, " Warning: skipping root %s: not a directory\n", path);
+    return false;
+  }
+
+  // kept without trailing '/', so units are built as root "/" company "/" device
+  size_t len = ps_root(path).len;
+  for (uint32_t i = 0; i < pool->nroot; i++)
+    if (pool->root[i].len == len && memcmp(pool->root[i].path, path, len) == 0)
+      return true;    // same root given twice
+
+  if (pool->nroot == pool->root_cap) {
+    uint32_t ncap = pool->root_cap ? pool->root_cap * 2 : 16;
+    PS_ROOTDIR *nr = (PS_ROOTDIR *)realloc(pool->root, ncap * sizeof(PS_ROOTDIR));
+    if (nr == NULL)
+      return false;
+    pool->root = nr;
+    pool->root_cap = ncap;
+  }
+  char *p = strndup(path, len);
+  if (p == NULL || fs_of(pool, sb.st_dev) == NULL) {
+    free(p);
+    return false;
+  }
+  pool->root[pool->nroot++] = ps_root(p);
+  return true;
+}
+
+
+bool vp_add_roots(VP_POOL *pool, const char *pattern)
+{
+  glob_t g;
+  int r = glob(pattern, GLOB_ONLYDIR | GLOB_TILDE | GLOB_BRACE, NULL, &g);
+  if (r == GLOB_NOMATCH) {
+    fprintf(stderr, " Warning: no root matches %s\n", pattern);
+    return false;
+  }
+  if (r != 0) {
+    fprintf(stderr, "Error: glob %s failed\n", pattern);
+    return false;
+  }
+
+  bool any = false;
+  for (size_t i = 0; i < g.gl_pathc; i++)
+    any |= add_root(pool, g.gl_pathv[i]);
+  globfree(&g);
+  return any;
+}
+
+
+static bool unit_add(VP_FS *fs, uint32_t root, const PS_ROOTDIR *rd,
+    const char *company, const char *device)
+{
+  if (fs->nunit == fs->cap) {
+    size_t ncap = fs->cap ? fs->cap * 2 : 256;
+    VP_UNIT *nu = (VP_UNIT *)realloc(fs->unit, ncap * sizeof(VP_UNIT));
+    if (nu == NULL)
+      return false;
+    fs->unit = nu;
+    fs->cap = ncap;
+  }
+
+  size_t clen = strlen(company), dlen = strlen(device);
+  char *path = (char *)malloc(rd->len + clen + dlen + 3);
+  if (path == NULL)
+    return false;
+  memcpy(path, rd->path, rd->len);
+  path[rd->len] = '/';
+  memcpy(path + rd->len + 1, company, clen);
+  path[rd->len + 1 + clen] = '/';
+  memcpy(path + rd->len + 2 + clen, device, dlen + 1);
+
+  VP_UNIT *u = &fs->unit[fs->nunit++];
+  u->root = root;
+  u->path = path;
+  u->company_off = (uint32_t)(rd->len + 1);
+  u->company_len = (uint32_t)clen;
+  u->device_off = (uint32_t)(rd->len + 2 + clen);
+  u->device_len = (uint32_t)dlen;
+  return true;
+}
+
+
+static bool is_subdir(int dfd, const struct dirent *de)
+{
+  const char *n = de->d_name;
+  if (n[0] == '.' && (n[1] == '\0' || (n[1] == '.' && n[2] == '\0')))
+    return false;
+  if (de->d_type == DT_DIR)
+    return true;
+  if (de->d_type != DT_UNKNOWN)
+    return false;
+
+  struct stat sb;
+  return fstatat(dfd, n, &sb, AT_SYMLINK_NOFOLLOW) == 0 && S_ISDIR(sb.st_mode);
+}
+
+
+static int unit_cmp(const void *pa, const void *pb)
+{
+  const VP_UNIT *a = (const VP_UNIT *)pa, *b = (const VP_UNIT *)pb;
+  if (a->root != b->root)
+    return (a->root < b->root) ? -1 : 1;
+  return strcmp(a->path, b->path);
+}
+
+
+bool vp_scan_units(VP_POOL *pool)
+{
+  for (uint32_t r = 0; r < pool->nroot; r++) {
+    const PS_ROOTDIR *rd = &pool->root[r];
+    int rfd = open(rd->path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    struct stat sb;
+    if (rfd < 0 || fstat(rfd, &sb) != 0) {
+      perror(rd->path);
+      if (rfd >= 0)
+        close(rfd);
+      continue;
+    }
+    VP_FS *fs = fs_of(pool, sb.st_dev);
+    DIR *rdir = fdopendir(rfd);
+    if (fs == NULL || rdir == NULL) {
+      perror(rd->path);
+      close(rfd);
+      continue;
+    }
+
+    struct dirent *ce;
+    while ((ce = readdir(rdir)) != NULL) {
+      if (!is_subdir(rfd, ce))
+        continue;
+      int cfd = openat(rfd, ce->d_name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+      DIR *cdir = (cfd >= 0) ? fdopendir(cfd) : NULL;
+      if (cdir == NULL) {
+        perror(ce->d_name);
+        if (cfd >= 0)
+          close(cfd);
+        continue;
+      }
+
+      struct dirent *de;
+      while ((de = readdir(cdir)) != NULL) {
+        if (is_subdir(cfd, de) && !unit_add(fs, r, rd, ce->d_name, de->d_name)) {
+          closedir(cdir);
+          closedir(rdir);
+          return false;
+        }
+      }
+      closedir(cdir);
+    }
+    closedir(rdir);
+  }
+
+  for (uint32_t f = 0; f < pool->nfs; f++) {
+    VP_FS *fs = &pool->fs[f];
+    qsort(fs->unit, fs->nunit, sizeof(VP_UNIT), unit_cmp);
+    fs->done = (uint8_t *)calloc(fs->nunit + 1, 1);
+    if (fs->done == NULL)
+      return false;
+  }
+  return true;
+}
+
+
+// ---- workers ----
+
+typedef struct tagVP_WORKER {
+  VP_POOL *pool;
+  VP_FS *fs;
+  VP_WORK_FN fn;
+  void *arg;
+} VP_WORKER;
+
+static void *worker_main(void *p)
+{
+  VP_WORKER *w = (VP_WORKER *)p;
+  VP_FS *fs = w->fs;
+  size_t i;
+
+  while ((i = __atomic_fetch_add(&fs->next, 1, __ATOMIC_RELAXED)) < fs->nunit) {
+    if (w->fn(w->pool, fs, &fs->unit[i], w->arg))
+      vp_unit_done(fs, &fs->unit[i]);
+  }
+  return NULL;
+}
+
+
+void vp_unit_done(VP_FS *fs, const VP_UNIT *u)
+{
+  if (fs->done == NULL)
+    return;
+  pthread_mutex_lock(&fs->lock);
+  fs->done[u - fs->unit] = 1;
+  while (fs->low < fs->nunit && fs->done[fs->low])
+    fs->low++;
+  pthread_mutex_unlock(&fs->lock);
+}
+
+
+bool vp_run(VP_POOL *pool, int workers, long io_budget, VP_WORK_FN fn, void *arg)
+{
+  if (workers < 1)
+    workers = 1;
+
+  size_t total = (size_t)pool->nfs * (size_t)workers;
+  pthread_t *thr = (pthread_t *)calloc(total, sizeof(pthread_t));
+  VP_WORKER *w = (VP_WORKER *)calloc(pool->nfs, sizeof(VP_WORKER));
+  bool *started = (bool *)calloc(total, sizeof(bool));
+  if (thr == NULL || w == NULL || started == NULL) {
+    free(thr);
+    free(w);
+    free(started);
+    return false;
+  }
+
+  for (uint32_t f = 0; f < pool->nfs; f++) {
+    VP_FS *fs = &pool->fs[f];
+    fs->next = 0;
+    fs->low = 0;
+    if (fs->done)
+      memset(fs->done, 0, fs->nunit);
+    fs->budget = io_budget;
+    fs->tokens = (double)io_budget;
+    clock_gettime(CLOCK_MONOTONIC, &fs->last);
+    w[f] = (VP_WORKER){ pool, fs, fn, arg };
+
+    // no more threads than units on this filesystem
+    int n = (fs->nunit < (size_t)workers) ? (int)fs->nunit : workers;
+    for (int k = 0; k < n; k++) {
+      size_t t = (size_t)f * (size_t)workers + (size_t)k;
+      int err = pthread_create(&thr[t], NULL, worker_main, &w[f]);
+      if (err != 0)
+        fprintf(stderr, "pthread_create: %s\n", strerror(err));
+      else
+        started[t] = true;
+    }
+  }
+
+  for (size_t t = 0; t < total; t++)
+    if (started[t])
+      pthread_join(thr[t], NULL);
+
+  // a filesystem whose threads all failed to start is finished inline
+  for (uint32_t f = 0; f < pool->nfs; f++)
+    worker_main(&w[f]);
+
+  free(thr);
+  free(w);
+  free(started);
+  return true;
+}
+
+
+size_t vp_done_low(VP_FS *fs)
+{
+  pthread_mutex_lock(&fs->lock);
+  size_t low = fs->low;
+  pthread_mutex_unlock(&fs->lock);
+  return low;
+}
+
+
+void vp_io_wait(VP_FS *fs)
+{
+  // unlocked peek for the unlimited case; the budget used is read under the lock
+  if (__atomic_load_n(&fs->budget, __ATOMIC_RELAXED) <= 0)
+    return;
+
+  for (;;) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    pthread_mutex_lock(&fs->lock);
+    long budget = fs->budget;
+    if (budget <= 0) {    // lifted while we slept
+      pthread_mutex_unlock(&fs->lock);
+      return;
+    }
+    double dt = (double)(now.tv_sec - fs->last.tv_sec) +
+      (double)(now.tv_nsec - fs->last.tv_nsec) / 1e9;
+    fs->last = now;
+    fs->tokens += dt * (double)budget;
+    if (fs->tokens > (double)budget)   // at most one second of burst
+      fs->tokens = (double)budget;
+    double tokens = fs->tokens;
+    pthread_mutex_unlock(&fs->lock);
+
+    if (tokens > 0)
+      return;
+    usleep(tokens < -(double)budget ? 1000000 :
+        (useconds_t)(-tokens * 1e6 / (double)budget) + 1000);
+  }
+}
+
+
+void vp_io_charge(VP_FS *fs, unsigned long files)
+{
+  if (files == 0 || __atomic_load_n(&fs->budget, __ATOMIC_RELAXED) <= 0)
+    return;
+  pthread_mutex_lock(&fs->lock);
+  if (fs->budget > 0)
+    fs->tokens -= (double)files;
+  pthread_mutex_unlock(&fs->lock);
+}
+
+
+void vp_io_set_budget(VP_FS *fs, long budget)
+{
+  pthread_mutex_lock(&fs->lock);
+  __atomic_store_n(&fs->budget, budget, __ATOMIC_RELAXED);
+  if (fs->tokens > (double)budget)
+    fs->tokens = (double)budget;
+  pthread_mutex_unlock(&fs->lock);
+}
@@ -0,0 +1,77 @@
+#ifndef __VOL_POOL_H__
+#define __VOL_POOL_H__
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <time.h>
+
+#include "path_schema.h"
+
+// Multi-volume scheduling in one process.
+// Roots (-r, repeatable, glob patterns) are grouped by the filesystem they
+// live on (st_dev). Each filesystem gets its own bounded worker pool and its
+// own I/O budget, so a slow disk only slows down its own workers. The work
+// unit is one device directory: <root>/<company>/<device>.
+
+typedef struct tagVP_UNIT {
+  uint32_t root;          // index into VP_POOL.root
+  char *path;             // <root>/<company>/<device>
+  uint32_t company_off, company_len;   // spans into path
+  uint32_t device_off, device_len;
+} VP_UNIT;
+
+typedef struct tagVP_FS {
+  dev_t dev;
+  VP_UNIT *unit;          // this filesystem's work list, sorted by root, then path
+  size_t nunit, cap;
+  size_t next;            // next unclaimed unit (atomic)
+  uint8_t *done;          // per unit, set once its work function returned
+  size_t low;             // units [0, low) are all done (under lock)
+
+  // files-per-second token bucket shared by this filesystem's workers (0: off)
+  long budget;
+  double tokens;
+  struct timespec last;
+  pthread_mutex_t lock;
+} VP_FS;
+
+typedef struct tagVP_POOL {
+  PS_ROOTDIR *root;       // root paths are owned by the pool
+  uint32_t nroot, root_cap;
+  VP_FS *fs;
+  uint32_t nfs, fs_cap;
+} VP_POOL;
+
+// called on a worker thread for every unit; units of one filesystem only
+// ever run on that filesystem's workers. Return false if work on the unit
+// goes on elsewhere: it is done once vp_unit_done() is called for it.
+typedef bool (*VP_WORK_FN)(VP_POOL *pool, VP_FS *fs, const VP_UNIT *u, void *arg);
+
+void vp_init(VP_POOL *pool);
+void vp_free(VP_POOL *pool);
+
+// add every directory matching pattern (glob(3); a plain path matches itself)
+bool vp_add_roots(VP_POOL *pool, const char *pattern);
+
+// list <company>/<device> directories of every root into per-filesystem work
+// lists; the order is stable from run to run (sorted), for checkpoints
+bool vp_scan_units(VP_POOL *pool);
+
+// run `workers` threads per filesystem until every unit is done
+bool vp_run(VP_POOL *pool, int workers, long io_budget, VP_WORK_FN fn, void *arg);
+
+// first unit of fs not done yet (nunit: all done); units claimed earlier may
+// still be running, but none before it is
+size_t vp_done_low(VP_FS *fs);
+void vp_unit_done(VP_FS *fs, const VP_UNIT *u);
+
+// I/O budget: wait until the filesystem has budget left, then charge what was done
+void vp_io_wait(VP_FS *fs);
+void vp_io_charge(VP_FS *fs, unsigned long files);
+
+// change the budget of a running filesystem (files/s, 0: unlimited)
+void vp_io_set_budget(VP_FS *fs, long budget);
+
+#endif //__VOL_POOL_H__
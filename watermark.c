@@ -0,0 +1,232 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "path_schema.h"
+#include "watermark.h"
+
+#define WM_MAGIC "rm_retention watermark 1\n"
+
+void wm_init(WM_CACHE *wm)
+{
+  memset(wm, 0, sizeof(*wm));
+}
+
+
+void wm_free(WM_CACHE *wm)
+{
+  for (size_t i = 0; i < wm->count; i++)
+    free(wm->entry[i].path);
+  free(wm->entry);
+  free(wm->slot);
+  memset(wm, 0, sizeof(*wm));
+}
+
+
+static uint32_t path_hash(const char *s)
+{
+  uint32_t h = 2166136261u;   // FNV-1a
+  for (; *s; s++)
+    h = (h ^ (unsigned char)*s) * 16777619u;
+  return h;
+}
+
+
+WM_ENTRY *wm_find(const WM_CACHE *wm, const char *dev_path)
+{
+  if (wm->nslot == 0)
+    return NULL;
+
+  size_t mask = wm->nslot - 1;
+  for (size_t i = path_hash(dev_path) & mask; wm->slot[i]; i = (i + 1) & mask) {
+    WM_ENTRY *e = &wm->entry[wm->slot[i] - 1];
+    if (strcmp(e->path, dev_path) == 0)
+      return e;
+  }
+  return NULL;
+}
+
+
+// entries are all read first, then indexed once
+static bool build_index(WM_CACHE *wm)
+{
+  size_t nslot = 16;
+  while (nslot < wm->count * 2)
+    nslot *= 2;
+  wm->slot = (uint32_t *)calloc(nslot, sizeof(uint32_t));
+  if (wm->slot == NULL)
+    return false;
+  wm->nslot = nslot;
+
+  for (size_t k = 0; k < wm->count; k++) {
+    size_t i = path_hash(wm->entry[k].path) & (nslot - 1);
+    while (wm->slot[i])
+      i = (i + 1) & (nslot - 1);
+    wm->slot[i] = (uint32_t)(k + 1);
+  }
+  return true;
+}
+
+
+void wm_dir(const WM_ENTRY *e, char *buf, size_t len)
+{
+  int n = snprintf(buf, len, "%04d", e->year);
+  const int comp[] = { e->month, e->day, e->hour, e->minute };
+  for (int l = PS_MONTH; l <= e->level && n > 0 && (size_t)n < len; l++)
+    n += snprintf(buf + n, len - (size_t)n, "/%02d", comp[l - PS_MONTH]);
+}
+
+
+// ---- file format ----
+// One line per device; the path is written as "<length> <bytes>":
+//
+//   rm_retention watermark 1
+//   <len> <path> <mtime sec> <mtime nsec> <level> <Y> <M> <D> <h> <m>
+//   end
+
+bool wm_save(const char *path, const WM_ENTRY *const *entry, size_t n)
+{
+  char tmp[PATH_MAX];
+  if (snprintf(tmp, sizeof(tmp), "%s.tmp", path) >= (int)sizeof(tmp))
+    return false;
+
+  int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  FILE *f = (fd >= 0) ? fdopen(fd, "w") : NULL;
+  if (f == NULL) {
+    fprintf(stderr, "Error: Unable to create %s: %s\n", tmp, strerror(errno));
+    if (fd >= 0)
+      close(fd);
+    return false;
+  }
+
+  bool ok = fputs(WM_MAGIC, f) >= 0;
+  for (size_t i = 0; ok && i < n; i++) {
+    const WM_ENTRY *e = entry[i];
+    ok = fprintf(f, "%zu %s %lld %lld %d %d %d %d %d %d\n", strlen(e->path), e->path,
+        (long long)e->mtime_sec, (long long)e->mtime_nsec, e->level,
+        e->year, e->month, e->day, e->hour, e->minute) > 0;
+  }
+  ok = ok && fputs("end\n", f) >= 0 && fflush(f) == 0 && fsync(fd) == 0;
+  ok = (fclose(f) == 0) && ok;
+
+  if (!ok || rename(tmp, path) != 0) {
+    fprintf(stderr, "Error: Unable to write %s: %s\n", path, strerror(errno));
+    unlink(tmp);
+    return false;
+  }
+  return true;
+}
+
+
+static bool read_file(const char *path, char **out, size_t *out_len)
+{
+  FILE *f = fopen(path, "r");
+  if (f == NULL)
+    return false;
+
+  char *buf = NULL;
+  size_t len = 0, cap = 0;
+  bool ok = true;
+  for (;;) {
+    if (len + 1 >= cap) {
+      cap = cap ? cap * 2 : 65536;
+      char *nb = (char *)realloc(buf, cap);
+      if (nb == NULL) {
+        ok = false;
+        break;
+      }
+      buf = nb;
+    }
+    size_t n = fread(buf + len, 1, cap - len - 1, f);
+    if (n == 0)
+      break;
+    len += n;
+  }
+  fclose(f);
+  if (!ok) {
+    free(buf);
+    return false;
+  }
+  buf[len] = '\0';
+  *out = buf;
+  *out_len = len;
+  return true;
+}
+
+
+static bool entry_add(WM_CACHE *wm, const WM_ENTRY *e)
+{
+  if (wm->count == wm->cap) {
+    size_t ncap = wm->cap ? wm->cap * 2 : 1024;
+    WM_ENTRY *ne = (WM_ENTRY *)realloc(wm->entry, ncap * sizeof(WM_ENTRY));
+    if (ne == NULL)
+      return false;
+    wm->entry = ne;
+    wm->cap = ncap;
+  }
+  wm->entry[wm->count++] = *e;
+  return true;
+}
+
+
+bool wm_load(const char *path, WM_CACHE *wm)
+{
+  wm_init(wm);
+
+  char *buf;
+  size_t len;
+  if (!read_file(path, &buf, &len))
+    return false;
+
+  const char *p = buf, *end = buf + len;
+  bool ok = (len >= sizeof(WM_MAGIC) - 1 && memcmp(p, WM_MAGIC, sizeof(WM_MAGIC) - 1) == 0);
+  if (ok)
+    p += sizeof(WM_MAGIC) - 1;
+
+  while (ok && !(end - p == 4 && memcmp(p, "end\n", 4) == 0)) {
+    char *q;
+    unsigned long long plen = strtoull(p, &q, 10);
+    if (q == p || *q != ' ' || plen == 0 || plen >= (unsigned long long)(end - q)) {
+      ok = false;
+      break;
+    }
+
+    WM_ENTRY e;
+    memset(&e, 0, sizeof(e));
+    e.path = strndup(q + 1, (size_t)plen);
+    p = q + 1 + plen;
+
+    long long v[8];
+    for (int i = 0; i < 8 && e.path; i++) {
+      v[i] = strtoll(p, &q, 10);
+      ok = ok && q != p && (*q == ' ' || (i == 7 && *q == '\n'));
+      p = q + 1;
+    }
+    ok = ok && e.path && v[2] >= PS_YEAR && v[2] <= PS_MINUTE;
+    if (ok) {
+      e.mtime_sec = v[0];
+      e.mtime_nsec = v[1];
+      e.level = (int32_t)v[2];
+      e.year = (int32_t)v[3];
+      e.month = (int32_t)v[4];
+      e.day = (int32_t)v[5];
+      e.hour = (int32_t)v[6];
+      e.minute = (int32_t)v[7];
+      ok = entry_add(wm, &e);
+    }
+    if (!ok)
+      free(e.path);
+  }
+  free(buf);
+
+  if (!ok || !build_index(wm)) {
+    fprintf(stderr, " Warning: %s is not a complete watermark cache, ignored\n", path);
+    wm_free(wm);
+    return false;
+  }
+  return true;
+}
@@ -0,0 +1,43 @@
+#ifndef __WATERMARK_H__
+#define __WATERMARK_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Per-device "oldest remaining date" cache (--watermark FILE).
+// After a clean pass over a device, the first date directory that was not
+// fully expired is remembered together with the device directory's mtime.
+// Next run, if the mtime is the same and that directory still exists (one
+// openat), nothing older can be there, and while it is within retention the
+// device is skipped without reading any directory.
+
+typedef struct tagWM_ENTRY {
+  char *path;             // device directory, <root>/<company>/<device>
+  int64_t mtime_sec, mtime_nsec;
+  int32_t level;          // PS_YEAR .. PS_MINUTE of the oldest directory
+  int32_t year, month, day, hour, minute;
+  bool used;              // matched by a device of this run
+} WM_ENTRY;
+
+typedef struct tagWM_CACHE {
+  WM_ENTRY *entry;
+  size_t count, cap;
+  uint32_t *slot;         // open addressing: entry index + 1, 0 = empty
+  size_t nslot;
+} WM_CACHE;
+
+void wm_init(WM_CACHE *wm);
+void wm_free(WM_CACHE *wm);
+
+// false if the file is missing (quietly) or damaged (with a message)
+bool wm_load(const char *path, WM_CACHE *wm);
+WM_ENTRY *wm_find(const WM_CACHE *wm, const char *dev_path);
+
+// relative path of the entry's directory, "YYYY/MM/DD..." (buf >= 20 bytes)
+void wm_dir(const WM_ENTRY *e, char *buf, size_t len);
+
+// write n entries to path.tmp, fsync, rename over path
+bool wm_save(const char *path, const WM_ENTRY *const *entry, size_t n);
+
+#endif //__WATERMARK_H__